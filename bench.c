@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+static const char * stage_names[BENCH_STAGES] = { "morton_reorder", "move", "draw_object", "process_impact_all", \
+	"gravity", "mass_center", "FrameBufferUpdate" };
+
+/*
+ * Time of every stage of every step is kept, percentiles need all of
+ * them. Stages called several times per step (gravity of block time
+ * steps) are summed into the step.
+ */
+static struct
+{
+	uint64_t * sample[BENCH_STAGES]; //ns, steps each
+	uint64_t current[BENCH_STAGES]; //ns, step in progress
+	uint64_t steps, size;
+	uint64_t start, end; //ns, first and last step
+}bench;
+
+/* Functions */
+static int compare_sample(const void * a, const void * b);
+static uint64_t percentile(uint64_t * sample, uint64_t size, uint8_t p);
+
+/**
+ * Start collecting, room for steps samples of each stage
+ */
+bool bench_init(uint64_t steps)
+{
+	bench_free();
+
+	for (uint8_t s = 0; s != BENCH_STAGES; s++)
+		if (!(bench.sample[s] = malloc(sizeof(uint64_t) * steps)))
+		{
+			bench_free();
+			return false;
+		}
+
+	bench.steps = steps;
+	bench.start = bench_clock();
+	return true;
+}
+
+/**
+ * Monotonic time, ns
+ */
+uint64_t bench_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Add time since start to the stage, returns now for the next one
+ */
+uint64_t bench_lap(bench_stage_t stage, uint64_t start)
+{
+	uint64_t now = bench_clock();
+
+	bench.current[stage] += now - start;
+	return now;
+}
+
+/**
+ * Close the step
+ */
+void bench_step(void)
+{
+	//gravity runs inside move, report the integrator alone
+	bench.current[BENCH_MOVE] -= bench.current[BENCH_GRAVITY] < bench.current[BENCH_MOVE] ? \
+		bench.current[BENCH_GRAVITY] : bench.current[BENCH_MOVE];
+
+	if (bench.size < bench.steps)
+	{
+		for (uint8_t s = 0; s != BENCH_STAGES; s++)
+			bench.sample[s][bench.size] = bench.current[s];
+		bench.size++;
+		bench.end = bench_clock();
+	}
+
+	memset(bench.current, 0, sizeof(bench.current));
+}
+
+/**
+ * Append one JSON line to file ("-" is stdout): config fields as given,
+ * steps per second, p50 and p99 of each stage in microseconds
+ */
+bool bench_report(const char * file, const char * config)
+{
+	FILE * out = strcmp(file, "-") ? fopen(file, "a") : stdout;
+	double seconds = (bench.end - bench.start) / 1e9;
+
+	if (!out)
+		return false;
+
+	fprintf(out, "{%s, \"steps\": %llu, \"steps_per_second\": %.3f", config, \
+		(unsigned long long)bench.size, seconds > 0 ? bench.size / seconds : 0);
+
+	for (uint8_t s = 0; s != BENCH_STAGES; s++)
+		fprintf(out, ", \"%s\": {\"p50_us\": %.3f, \"p99_us\": %.3f}", stage_names[s], \
+			percentile(bench.sample[s], bench.size, 50) / 1e3, percentile(bench.sample[s], bench.size, 99) / 1e3);
+
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+
+	return true;
+}
+
+/**
+ * Release samples
+ */
+void bench_free(void)
+{
+	for (uint8_t s = 0; s != BENCH_STAGES; s++)
+		free(bench.sample[s]);
+	memset(&bench, 0, sizeof(bench));
+}
+
+static int compare_sample(const void * a, const void * b)
+{
+	const uint64_t * s1 = a, * s2 = b;
+
+	return *s1 < *s2 ? -1 : *s1 > *s2;
+}
+
+/**
+ * Nearest rank percentile, sorts samples in place
+ */
+static uint64_t percentile(uint64_t * sample, uint64_t size, uint8_t p)
+{
+	if (!size)
+		return 0;
+
+	qsort(sample, size, sizeof(uint64_t), compare_sample);
+
+	uint64_t rank = (size * p + 99) / 100;
+	return sample[rank ? rank - 1 : 0];
+}
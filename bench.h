@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Timed stages of one simulation step */
+typedef enum
+{
+	BENCH_REORDER,
+	BENCH_MOVE, //integrator without gravity
+	BENCH_DRAW,
+	BENCH_IMPACT,
+	BENCH_GRAVITY,
+	BENCH_MASS_CENTER,
+	BENCH_UPDATE,
+	BENCH_STAGES,
+}bench_stage_t;
+
+bool bench_init(uint64_t steps);
+uint64_t bench_clock(void);
+uint64_t bench_lap(bench_stage_t stage, uint64_t start);
+void bench_step(void);
+bool bench_report(const char * file, const char * config);
+void bench_free(void);
+
+#endif
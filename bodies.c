@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "bodies.h"
+
+static uint64_t align(uint64_t size)
+{
+	return (size + BODIES_ALIGN - 1) / BODIES_ALIGN * BODIES_ALIGN;
+}
+
+/**
+ * Bytes of the arena for capacity bodies, 0 if that does not fit in
+ * size_t (above about 39M bodies on 32 bit hosts)
+ */
+size_t bodies_arena_size(uint32_t capacity)
+{
+	const uint64_t total = 9 * align((uint64_t)sizeof(double) * capacity) + 2 * align(capacity) + \
+		align((uint64_t)sizeof(body_info_t) * capacity) + 2 * align((uint64_t)sizeof(uint32_t) * capacity);
+
+	return total > SIZE_MAX ? 0 : (size_t)total;
+}
+
+/**
+ * Point arrays of the store into arena of capacity bodies, contents are
+ * left as they are
+ */
+void bodies_layout(bodies_t * bodies, void * base, uint32_t capacity)
+{
+	const size_t hot = align(sizeof(double) * capacity);
+	const size_t ids = align(sizeof(uint32_t) * capacity);
+	uint8_t * arena = base;
+
+	bodies->capacity = capacity;
+	bodies->x = (double *)arena; arena += hot;
+	bodies->y = (double *)arena; arena += hot;
+	bodies->vx = (double *)arena; arena += hot;
+	bodies->vy = (double *)arena; arena += hot;
+	bodies->ax = (double *)arena; arena += hot;
+	bodies->ay = (double *)arena; arena += hot;
+	bodies->m = (double *)arena; arena += hot;
+	bodies->x0 = (double *)arena; arena += hot;
+	bodies->y0 = (double *)arena; arena += hot;
+	bodies->alive = arena; arena += align(capacity);
+	bodies->level = arena; arena += align(capacity);
+	bodies->info = (body_info_t *)arena; arena += align(sizeof(body_info_t) * capacity);
+	bodies->id = (uint32_t *)arena; arena += ids;
+	bodies->slot = (uint32_t *)arena;
+}
+
+/**
+ * Allocate store for size bodies, all zero
+ */
+bool bodies_alloc(bodies_t * bodies, uint32_t size)
+{
+	const size_t total = bodies_arena_size(size);
+
+	memset(bodies, 0, sizeof(bodies_t));
+
+	if (size && !total)
+		return false;
+
+	void * arena = aligned_alloc(BODIES_ALIGN, total ? total : BODIES_ALIGN);
+	if (!arena)
+		return false;
+
+	memset(arena, 0, total);
+
+	bodies->arena = arena;
+	bodies->size = size;
+	bodies_layout(bodies, arena, size);
+
+	for (uint32_t i = 0; i != size; i++)
+		bodies->id[i] = bodies->slot[i] = i;
+
+	return true;
+}
+
+/**
+ * Fill body i from object description
+ */
+void bodies_set(bodies_t * bodies, uint32_t i, const object_t * object)
+{
+	body_info_t * info = &bodies->info[i];
+
+	bodies->x[i] = bodies->x0[i] = object->x;
+	bodies->y[i] = bodies->y0[i] = object->y;
+	bodies->vx[i] = object->vx;
+	bodies->vy[i] = object->vy;
+	bodies->ax[i] = 0;
+	bodies->ay[i] = 0;
+	bodies->m[i] = object->weight;
+	bodies->alive[i] = true;
+	bodies->level[i] = 0;
+
+	info->color = object->color;
+	info->r = object->r;
+	info->isMoving = true;
+
+	if (object->name == info->name)
+		;	//already in place
+	else if (object->name)
+	{
+		strncpy(info->name, object->name, BODY_NAME_SIZE - 1);
+		info->name[BODY_NAME_SIZE - 1] = 0;
+	}
+	else
+		info->name[0] = 0;
+}
+
+/**
+ * Release the arena, one free (or unmap) for all bodies
+ */
+void bodies_free(bodies_t * bodies)
+{
+	if (bodies->map)
+		munmap(bodies->map, bodies->map_size);
+	else
+		free(bodies->arena);
+	memset(bodies, 0, sizeof(bodies_t));
+}
@@ -0,0 +1,68 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BODY_NAME_SIZE		20
+#define BODIES_ALIGN		64 //cache line
+#define BODIES_NONE		UINT32_MAX
+
+/* Initial properties of one object */
+typedef struct
+{
+	uint32_t color;
+	uint16_t r; //radius
+	double weight;
+	double x, y, vx, vy;
+	const char * name;
+}object_t;
+
+/* Cold part of a body: look and metadata */
+typedef struct
+{
+	uint32_t color;
+	uint16_t r; //radius
+	bool isMoving;
+
+	char name[BODY_NAME_SIZE];
+}body_info_t;
+
+/*
+ * Body store. Hot fields used by every simulation pass live in separate
+ * aligned arrays, the rest is in the info table. Everything, names
+ * included, comes from one arena allocation.
+ *
+ * Bodies can be reordered in the store, id[] keeps the external id of the
+ * body in each slot and slot[] maps ids back (BODIES_NONE when the body
+ * was dropped from the store).
+ *
+ * The arena has no pointers inside, its layout depends on capacity only,
+ * so it can be written to a file as is and mapped back (see checkpoint.c).
+ */
+typedef struct
+{
+	uint32_t size; //bodies in the store
+	uint32_t capacity; //allocated, also amount of ids
+
+	double * x, * y, * vx, * vy, * ax, * ay, * m;
+	double * x0, * y0; //position at the start of the step
+	uint8_t * alive; //after impact 2 objects become 1
+	uint8_t * level; //time step is dt / 2^level
+
+	body_info_t * info;
+	uint32_t * id, * slot;
+
+	void * arena;
+	void * map; //file mapping the arena lives in, NULL = heap
+	size_t map_size;
+}bodies_t;
+
+size_t bodies_arena_size(uint32_t capacity);
+void bodies_layout(bodies_t * bodies, void * base, uint32_t capacity);
+bool bodies_alloc(bodies_t * bodies, uint32_t size);
+void bodies_set(bodies_t * bodies, uint32_t i, const object_t * object);
+void bodies_free(bodies_t * bodies);
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "broadphase.h"
+#include "workers.h"
+
+/*
+ * Spatial hash of live bodies. Cells are square, a body is hashed by the
+ * cell of its position, the table is sorted by bucket (counting sort), so
+ * each bucket is a contiguous run of body indexes. Different cells can
+ * share a bucket, that only adds candidates, never loses one.
+ */
+static struct
+{
+	uint32_t * bucket; //bucket of each body, BODIES_NONE if dead
+	int32_t * cx, * cy; //cell of each body
+	uint32_t * start; //first entry of each bucket, buckets + 1
+	uint32_t * entry; //body indexes sorted by bucket
+	uint32_t size, capacity;
+	uint32_t mask; //buckets - 1
+
+	//current build
+	const bodies_t * bodies;
+	double cell, ox, oy;
+}grid;
+
+/* Functions */
+static uint32_t hash(int32_t cx, int32_t cy);
+static void cell_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Hash live bodies into cells of given size. Two bodies closer than
+ * cell are always in the same or neighbouring cells.
+ * Returns false if out of memory.
+ */
+bool broadphase_build(const bodies_t * bodies, double cell)
+{
+	uint32_t buckets = 64;
+
+	while (buckets < 2 * bodies->size)
+		buckets <<= 1;
+
+	if (bodies->size > grid.capacity || buckets - 1 > grid.mask)
+	{
+		broadphase_free();
+		grid.capacity = bodies->size;
+		grid.bucket = malloc(sizeof(uint32_t) * grid.capacity);
+		grid.cx = malloc(sizeof(int32_t) * grid.capacity);
+		grid.cy = malloc(sizeof(int32_t) * grid.capacity);
+		grid.entry = malloc(sizeof(uint32_t) * grid.capacity);
+		grid.start = malloc(sizeof(uint32_t) * (buckets + 1));
+
+		if (!grid.bucket || !grid.cx || !grid.cy || !grid.entry || !grid.start)
+		{
+			broadphase_free();
+			return false;
+		}
+	}
+
+	grid.mask = buckets - 1;
+	grid.size = bodies->size;
+	grid.bodies = bodies;
+	grid.cell = cell > 0 ? cell : 1;
+	grid.ox = grid.oy = INFINITY;
+
+	for (uint32_t i = 0; i != bodies->size; i++)
+		if (bodies->alive[i])
+		{
+			grid.ox = fmin(grid.ox, bodies->x[i]);
+			grid.oy = fmin(grid.oy, bodies->y[i]);
+		}
+
+	workers_run(cell_job, NULL, bodies->size, 4096);
+
+	/* counting sort by bucket */
+	memset(grid.start, 0, sizeof(uint32_t) * (buckets + 1));
+
+	for (uint32_t i = 0; i != grid.size; i++)
+		if (grid.bucket[i] != BODIES_NONE)
+			grid.start[grid.bucket[i] + 1]++;
+
+	for (uint32_t b = 0; b != buckets; b++)
+		grid.start[b + 1] += grid.start[b];
+
+	for (uint32_t i = 0; i != grid.size; i++)
+		if (grid.bucket[i] != BODIES_NONE)
+			grid.entry[grid.start[grid.bucket[i]]++] = i;
+
+	//start[] was moved one bucket forward by the fill, shift it back
+	memmove(grid.start + 1, grid.start, sizeof(uint32_t) * buckets);
+	grid.start[0] = 0;
+	return true;
+}
+
+/**
+ * Call visit(ctx, i, j) for every body j != i in the same or neighbouring
+ * cells of body i, j in bucket order. Each j is visited once.
+ */
+void broadphase_visit(uint32_t i, broadphase_visit_t visit, void * ctx)
+{
+	uint32_t seen[9], seen_s = 0;
+
+	if (grid.bucket[i] == BODIES_NONE)
+		return;
+
+	for (int8_t dy = -1; dy <= 1; dy++)
+		for (int8_t dx = -1; dx <= 1; dx++)
+		{
+			uint32_t b = hash(grid.cx[i] + dx, grid.cy[i] + dy);
+			bool done = false;
+
+			for (uint8_t s = 0; s != seen_s; s++)
+				if (seen[s] == b)
+					done = true;
+
+			if (done)
+				continue;
+
+			seen[seen_s++] = b;
+
+			for (uint32_t e = grid.start[b]; e != grid.start[b + 1]; e++)
+			{
+				uint32_t j = grid.entry[e];
+
+				if (j != i && !visit(ctx, i, j))
+					return;
+			}
+		}
+}
+
+/**
+ * Release hash memory
+ */
+void broadphase_free(void)
+{
+	free(grid.bucket);
+	free(grid.cx);
+	free(grid.cy);
+	free(grid.start);
+	free(grid.entry);
+	memset(&grid, 0, sizeof(grid));
+}
+
+static uint32_t hash(int32_t cx, int32_t cy)
+{
+	return ((uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u) & grid.mask;
+}
+
+static void cell_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const bodies_t * bodies = grid.bodies;
+
+	for (uint32_t i = begin; i != end; i++)
+	{
+		if (!bodies->alive[i])
+		{
+			grid.bucket[i] = BODIES_NONE;
+			continue;
+		}
+
+		//far away bodies share the last cell, it only adds candidates
+		grid.cx[i] = fmin(floor((bodies->x[i] - grid.ox) / grid.cell), INT32_MAX / 2);
+		grid.cy[i] = fmin(floor((bodies->y[i] - grid.oy) / grid.cell), INT32_MAX / 2);
+		grid.bucket[i] = hash(grid.cx[i], grid.cy[i]);
+	}
+}
@@ -0,0 +1,15 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+/* Called for each candidate pair, return false to stop the walk */
+typedef bool (*broadphase_visit_t)(void * ctx, uint32_t i, uint32_t j);
+
+bool broadphase_build(const bodies_t * bodies, double cell);
+void broadphase_visit(uint32_t i, broadphase_visit_t visit, void * ctx);
+void broadphase_free(void);
+
+#endif
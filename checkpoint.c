@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "checkpoint.h"
+#include "space.h"
+
+#define CHECKPOINT_MAGIC	"PSPACE\r\n" //CR LF catches text mode transfers
+#define CHECKPOINT_ENDIAN	0x01020304
+#define CHECKPOINT_HEADER	4096 //arena starts on a page, mmap offsets must be
+
+/*
+ * File is a header padded to a page and the bodies arena as it is in
+ * memory. All numbers are little-endian with sizes fixed below, the arena
+ * layout only depends on capacity (bodies_layout()), so loading is a
+ * check of the header and mmap of the file, bodies are used right from
+ * the mapping. The mapping is private: pages are read on first touch and
+ * copied on first write, the file itself is never changed.
+ */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t endian; //CHECKPOINT_ENDIAN as written
+	uint32_t header; //bytes before the arena
+	uint32_t info; //sizeof(body_info_t)
+	uint32_t size, capacity;
+	uint64_t arena; //bytes
+	uint64_t step;
+	double time, dt, weight;
+	uint32_t seed;
+	uint8_t levels;
+	uint8_t reserved[3];
+}checkpoint_header_t;
+
+_Static_assert(sizeof(checkpoint_header_t) == 80, "checkpoint header layout");
+_Static_assert(sizeof(body_info_t) == 28, "checkpoint body info layout");
+
+/* Functions */
+static uint32_t check_bodies(const bodies_t * bodies, uint8_t levels);
+
+/**
+ * Write bodies and state to file in one go. The file is written under a
+ * temporary name and renamed, an old checkpoint stays whole on failure.
+ */
+bool checkpoint_save(const char * file, const bodies_t * bodies, const checkpoint_state_t * state)
+{
+	static uint8_t page[CHECKPOINT_HEADER];
+	checkpoint_header_t * header = (checkpoint_header_t *)page;
+	const size_t arena = bodies_arena_size(bodies->capacity);
+	struct iovec part[2] = { { page, sizeof(page) }, { bodies->arena, arena } };
+	size_t left = sizeof(page) + arena;
+	char temp[4096];
+
+	if (*(const uint8_t *)&(uint32_t){ 1 } != 1)
+		return false; //format is little-endian, only such hosts write it
+
+	memset(page, 0, sizeof(page));
+	memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+	header->version = CHECKPOINT_VERSION;
+	header->endian = CHECKPOINT_ENDIAN;
+	header->header = CHECKPOINT_HEADER;
+	header->info = sizeof(body_info_t);
+	header->size = bodies->size;
+	header->capacity = bodies->capacity;
+	header->arena = arena;
+	header->step = state->step;
+	header->time = state->time;
+	header->dt = state->dt;
+	header->weight = state->weight;
+	header->seed = state->seed;
+	header->levels = state->levels;
+
+	snprintf(temp, sizeof(temp), "%s.tmp", file);
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	//one sequential write, split only if the kernel takes less
+	while (left)
+	{
+		ssize_t done = writev(fd, part, 2);
+
+		if (done <= 0)
+			break;
+
+		left -= done;
+		for (uint8_t p = 0; p != 2; p++)
+		{
+			size_t n = (size_t)done < part[p].iov_len ? (size_t)done : part[p].iov_len;
+
+			part[p].iov_base = (uint8_t *)part[p].iov_base + n;
+			part[p].iov_len -= n;
+			done -= n;
+		}
+	}
+
+	if (close(fd) || left || rename(temp, file))
+	{
+		unlink(temp);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Map checkpoint file as the body store, bodies_free() unmaps it.
+ * Returns "OK" or what is wrong with the file.
+ */
+const char * checkpoint_load(const char * file, bodies_t * bodies, checkpoint_state_t * state)
+{
+	static char error_body[32];
+	checkpoint_header_t header;
+	struct stat st;
+	int fd = open(file, O_RDONLY);
+
+	if (fd < 0)
+		return "cannot open";
+
+	if (fstat(fd, &st) || pread(fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		close(fd);
+		return "cannot read";
+	}
+
+	const char * error = memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) ? "not a checkpoint" : \
+		header.version != CHECKPOINT_VERSION ? "unsupported version" : \
+		header.endian != CHECKPOINT_ENDIAN ? "byte order differs from this machine" : \
+		header.header != CHECKPOINT_HEADER || header.info != sizeof(body_info_t) || header.size > header.capacity || \
+		header.arena != bodies_arena_size(header.capacity) ? "layout differs from this build" : \
+		(uint64_t)st.st_size != header.header + header.arena ? "truncated" : \
+		header.levels > SPACE_LEVELS_MAX || !isfinite(header.time) || !isfinite(header.dt) || header.dt <= 0 || \
+		!isfinite(header.weight) || header.weight <= 0 ? "state out of range" : 0;
+
+	if (error)
+	{
+		close(fd);
+		return error;
+	}
+
+	void * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return "cannot map";
+
+	memset(bodies, 0, sizeof(bodies_t));
+	bodies->arena = (uint8_t *)map + header.header;
+	bodies->size = header.size;
+	bodies->map = map;
+	bodies->map_size = st.st_size;
+	bodies_layout(bodies, bodies->arena, header.capacity);
+
+	//same rules as scenarios, and ids, slots and levels in range
+	const uint32_t bad = check_bodies(bodies, header.levels);
+
+	if (bad != BODIES_NONE)
+	{
+		bodies_free(bodies);
+		snprintf(error_body, sizeof(error_body), "bad body %u", bad);
+		return error_body;
+	}
+
+	state->step = header.step;
+	state->time = header.time;
+	state->dt = header.dt;
+	state->weight = header.weight;
+	state->seed = header.seed;
+	state->levels = header.levels;
+
+	return "OK";
+}
+
+/**
+ * First body (slot) that cannot come from a run, BODIES_NONE if all are fine
+ */
+static uint32_t check_bodies(const bodies_t * bodies, uint8_t levels)
+{
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		if (bodies->alive[i] > 1 || bodies->level[i] > levels || bodies->id[i] >= bodies->capacity || \
+			bodies->slot[bodies->id[i]] != i || bodies->info[i].name[BODY_NAME_SIZE - 1])
+			return i;
+
+		if (bodies->alive[i] && (!isfinite(bodies->x[i]) || !isfinite(bodies->y[i]) || !isfinite(bodies->vx[i]) || \
+			!isfinite(bodies->vy[i]) || !isfinite(bodies->ax[i]) || !isfinite(bodies->ay[i]) || \
+			!isfinite(bodies->x0[i]) || !isfinite(bodies->y0[i]) || !isfinite(bodies->m[i]) || bodies->m[i] <= 0))
+			return i;
+	}
+
+	//ids of dropped bodies map nowhere
+	for (uint32_t id = 0; id != bodies->capacity; id++)
+		if (bodies->slot[id] != BODIES_NONE && (bodies->slot[id] >= bodies->size || bodies->id[bodies->slot[id]] != id))
+			return bodies->slot[id];
+
+	return BODIES_NONE;
+}
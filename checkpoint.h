@@ -0,0 +1,24 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+#define CHECKPOINT_VERSION	1
+
+/* Simulation state besides the bodies */
+typedef struct
+{
+	uint64_t step; //steps done
+	double time; //simulation time, sum of dt
+	double dt;
+	double weight; //total mass at the start, mass center divides by it
+	uint32_t seed; //random generator, nothing is drawn after creation
+	uint8_t levels; //block time steps
+}checkpoint_state_t;
+
+bool checkpoint_save(const char * file, const bodies_t * bodies, const checkpoint_state_t * state);
+const char * checkpoint_load(const char * file, bodies_t * bodies, checkpoint_state_t * state);
+
+#endif
@@ -0,0 +1,440 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include "display.h"
+#include "pixel.h"
+
+struct fb_var_screeninfo vinfo; //can be used as public
+
+/*
+ * Linux framebuffer device. With page flipping all virtual pages are
+ * mapped, frames are drawn straight into the back page and shown by
+ * panning. Drawing is incremental, so a page coming back to be drawn
+ * again first gets tiles changed while it was not the back page, those
+ * are kept per page as stale tiles. Without flipping (one page, screen
+ * format is not the 32 bit one of the back buffer or driver refused)
+ * damage of the back buffer is converted to the screen format while it
+ * is copied.
+ */
+static struct
+{
+	int fd;
+	uint8_t * screen; //all pages
+	uint32_t map; //bytes mapped
+	uint32_t line; //bytes per line
+	uint8_t bytes; //per pixel on the screen
+	pixel_convert_t convert; //back buffer to screen format
+	bool native; //screen has back buffer format, copy is plain
+	const uint32_t * image; //last presented back buffer
+	uint32_t image_line; //pixels per line of the back buffer
+	uint8_t pages; //0 = copy back buffer to the screen
+	uint8_t back; //page drawn into
+	bool vsync;
+	uint16_t tiles_x, tiles_y;
+	uint8_t * stale[DISPLAY_PAGES_MAX]; //tiles older than on the front page
+}fbdev = { .fd = -1 };
+
+/* Offscreen image in memory */
+static struct
+{
+	uint32_t * image;
+	size_t size; //bytes
+	uint16_t height;
+}memory;
+
+/* Functions */
+static bool parse_size(const char * io, uint16_t * width, uint16_t * height);
+static void copy_rect(uint8_t * dst, uint32_t dst_line, const uint8_t * src, uint32_t src_line, \
+	const display_rect_t * rect);
+static const char * fbdev_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height);
+static bool fbdev_flip(uint8_t pages);
+static uint32_t * fbdev_page(uint8_t page);
+static uint32_t * fbdev_buffer(uint32_t * stride);
+static void fbdev_present(const uint32_t * image, const display_damage_t * damage);
+static const uint32_t * fbdev_pixels(void);
+static void fbdev_close(void);
+static const char * memory_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height);
+static void memory_present(const uint32_t * image, const display_damage_t * damage);
+static const uint32_t * memory_pixels(void);
+static void memory_close(void);
+static const char * null_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height);
+static uint32_t * own_buffer(uint32_t * stride);
+static void null_present(const uint32_t * image, const display_damage_t * damage);
+static const uint32_t * null_pixels(void);
+static void null_close(void);
+
+static const display_backend_t backends[] = {
+	{ .name = "memory", .raster = true, .visible = false, .open = memory_open, \
+		.buffer = own_buffer, .present = memory_present, .pixels = memory_pixels, .close = memory_close },
+	{ .name = "null", .raster = false, .visible = false, .open = null_open, \
+		.buffer = own_buffer, .present = null_present, .pixels = null_pixels, .close = null_close },
+	{ .name = "fbdev", .raster = true, .visible = true, .open = fbdev_open, \
+		.buffer = fbdev_buffer, .present = fbdev_present, .pixels = fbdev_pixels, .close = fbdev_close },
+};
+
+/**
+ * Backend for io: "memory[:WxH]", "null[:WxH]", anything else is
+ * a framebuffer device path
+ */
+const display_backend_t * display_select(const char * io)
+{
+	const uint8_t count = sizeof(backends) / sizeof(backends[0]);
+
+	for (uint8_t i = 0; io && i != count - 1; i++)
+	{
+		size_t len = strlen(backends[i].name);
+
+		if (!strncmp(io, backends[i].name, len) && (io[len] == 0 || io[len] == ':'))
+			return &backends[i];
+	}
+
+	return &backends[count - 1];
+}
+
+/**
+ * Wait for vertical blank after page flip, if driver supports it
+ */
+void display_vsync(bool wait)
+{
+	fbdev.vsync = wait;
+}
+
+/**
+ * Bytes of a 32 bit image, 0 if above DISPLAY_IMAGE_MAX
+ */
+size_t display_image_size(uint16_t width, uint16_t height)
+{
+	const uint64_t bytes = (uint64_t)sizeof(uint32_t) * width * height;
+
+	return bytes > DISPLAY_IMAGE_MAX ? 0 : (size_t)bytes;
+}
+
+/**
+ * Size after the name, default if not given
+ */
+static bool parse_size(const char * io, uint16_t * width, uint16_t * height)
+{
+	const char * size = strchr(io, ':');
+	unsigned w, h;
+
+	*width = DISPLAY_WIDTH;
+	*height = DISPLAY_HEIGHT;
+
+	if (!size)
+		return true;
+
+	if (sscanf(size + 1, "%ux%u", &w, &h) != 2 || !w || !h || w > UINT16_MAX || h > UINT16_MAX)
+		return false;
+
+	*width = w;
+	*height = h;
+	return true;
+}
+
+/**
+ * Copy rectangle of 32 bit pixels between images
+ */
+static void copy_rect(uint8_t * dst, uint32_t dst_line, const uint8_t * src, uint32_t src_line, \
+	const display_rect_t * rect)
+{
+	const uint32_t x = rect->x0 * sizeof(uint32_t), bytes = (rect->x1 - rect->x0) * sizeof(uint32_t);
+
+	for (uint32_t y = rect->y0; y != rect->y1; y++)
+		memcpy(dst + dst_line * y + x, src + src_line * y + x, bytes);
+}
+
+static const char * fbdev_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height)
+{
+	if (io == NULL) io = "/dev/fb0"; //default to main screen
+
+	fbdev.fd = open(io, O_RDWR);
+
+	if (fbdev.fd < 0)
+		return "Fail to open stream!";
+
+	if (ioctl(fbdev.fd, FBIOGET_VSCREENINFO, &vinfo) < 0)
+	{
+		fbdev_close();
+		return "Fail get info structure!";
+	}
+
+	*width = vinfo.xres;
+	*height = vinfo.yres;
+
+	const pixel_format_t format = { vinfo.bits_per_pixel, { vinfo.red.offset, vinfo.green.offset, vinfo.blue.offset }, \
+		{ vinfo.red.length, vinfo.green.length, vinfo.blue.length } };
+	const char * name;
+
+	if (!(fbdev.convert = pixel_converter(&format, &name)))
+	{
+		fbdev_close();
+		return "Unsupported pixel format!";
+	}
+	fbdev.native = pixel_native(&format);
+	fbdev.bytes = vinfo.bits_per_pixel / 8;
+	fbdev.image_line = vinfo.xres;
+	printf("Pixel format: %s\n", name);
+
+	if (multiBuffer > 1 && fbdev.native && fbdev_flip(multiBuffer > DISPLAY_PAGES_MAX ? DISPLAY_PAGES_MAX : multiBuffer))
+		return "OK";
+
+	//copy path, one page
+	struct fb_fix_screeninfo finfo;
+
+	fbdev.line = ioctl(fbdev.fd, FBIOGET_FSCREENINFO, &finfo) < 0 ? \
+		vinfo.xres * vinfo.bits_per_pixel / 8 : finfo.line_length;
+	fbdev.map = fbdev.line * vinfo.yres;
+	fbdev.screen = mmap(0, fbdev.map, PROT_READ | PROT_WRITE, MAP_SHARED, fbdev.fd, 0);
+	if (fbdev.screen == MAP_FAILED)
+	{
+		fbdev.screen = 0;
+		fbdev_close();
+		return "Fail to map screen!";
+	}
+
+	return "OK";
+}
+
+/**
+ * Try to set up page flipping, false if driver does not allow it
+ */
+static bool fbdev_flip(uint8_t pages)
+{
+	struct fb_fix_screeninfo finfo;
+
+	vinfo.xres_virtual = vinfo.xres;
+	vinfo.yres_virtual = vinfo.yres * pages;
+	vinfo.xoffset = vinfo.yoffset = 0;
+	if (ioctl(fbdev.fd, FBIOPUT_VSCREENINFO, &vinfo) < 0 || ioctl(fbdev.fd, FBIOGET_VSCREENINFO, &vinfo) < 0 || \
+		vinfo.yres_virtual < vinfo.yres * pages || ioctl(fbdev.fd, FBIOGET_FSCREENINFO, &finfo) < 0)
+		return false;
+
+	fbdev.line = finfo.line_length;
+	fbdev.map = fbdev.line * vinfo.yres_virtual;
+	fbdev.screen = mmap(0, fbdev.map, PROT_READ | PROT_WRITE, MAP_SHARED, fbdev.fd, 0);
+	if (fbdev.screen == MAP_FAILED)
+	{
+		fbdev.screen = 0;
+		return false;
+	}
+
+	if (ioctl(fbdev.fd, FBIOPAN_DISPLAY, &vinfo) < 0)
+	{
+		munmap(fbdev.screen, fbdev.map);
+		fbdev.screen = 0;
+		return false;
+	}
+
+	fbdev.tiles_x = (vinfo.xres + DISPLAY_TILE - 1) / DISPLAY_TILE;
+	fbdev.tiles_y = (vinfo.yres + DISPLAY_TILE - 1) / DISPLAY_TILE;
+	for (uint8_t p = 0; p != pages; p++)
+	{
+		fbdev.stale[p] = malloc(fbdev.tiles_x * fbdev.tiles_y);
+		if (!fbdev.stale[p])
+		{
+			munmap(fbdev.screen, fbdev.map);
+			fbdev.screen = 0;
+			return false;
+		}
+
+		//nothing is drawn yet, pages other than the first back one are stale
+		memset(fbdev.stale[p], p != 1, fbdev.tiles_x * fbdev.tiles_y);
+	}
+
+	fbdev.pages = pages;
+	fbdev.back = 1; //page 0 is on the screen
+	return true;
+}
+
+static uint32_t * fbdev_page(uint8_t page)
+{
+	return (uint32_t *)(fbdev.screen + (size_t)fbdev.line * vinfo.yres * page);
+}
+
+static uint32_t * fbdev_buffer(uint32_t * stride)
+{
+	if (!fbdev.pages)
+		return 0;
+
+	*stride = fbdev.line / sizeof(uint32_t);
+	return fbdev_page(fbdev.back);
+}
+
+/**
+ * Flip: pan to the back page, then bring the next back page up to date
+ * from the one just shown. Copy damage of the image without flipping.
+ */
+static void fbdev_present(const uint32_t * image, const display_damage_t * damage)
+{
+	if (!fbdev.pages)
+	{
+		for (uint32_t r = 0; r != damage->size && (const uint8_t *)image != fbdev.screen; r++)
+		{
+			const display_rect_t * rect = &damage->rect[r];
+
+			for (uint32_t y = rect->y0; y != rect->y1; y++)
+				fbdev.convert(fbdev.screen + fbdev.line * y + fbdev.bytes * rect->x0, image + fbdev.image_line * y + rect->x0, \
+					rect->x1 - rect->x0);
+		}
+		fbdev.image = image;
+		return;
+	}
+
+	//tiles changed in this frame are stale in every other page
+	for (uint32_t r = 0; r != damage->size; r++)
+	{
+		const display_rect_t * rect = &damage->rect[r];
+
+		for (uint16_t ty = rect->y0 / DISPLAY_TILE; ty != (rect->y1 + DISPLAY_TILE - 1) / DISPLAY_TILE; ty++)
+			for (uint8_t p = 0; p != fbdev.pages; p++)
+				if (p != fbdev.back)
+					memset(fbdev.stale[p] + ty * fbdev.tiles_x + rect->x0 / DISPLAY_TILE, 1, \
+						(rect->x1 + DISPLAY_TILE - 1) / DISPLAY_TILE - rect->x0 / DISPLAY_TILE);
+	}
+
+	vinfo.xoffset = 0;
+	vinfo.yoffset = vinfo.yres * fbdev.back;
+	if (ioctl(fbdev.fd, FBIOPAN_DISPLAY, &vinfo) < 0)
+	{
+		//driver refused: show this frame on the first page and stop flipping, the page
+		//drawn into stays the back buffer and only its damage is copied from now on
+		vinfo.yoffset = 0;
+		ioctl(fbdev.fd, FBIOPAN_DISPLAY, &vinfo);
+		if (fbdev.back)
+			memcpy(fbdev_page(0), fbdev_page(fbdev.back), (size_t)fbdev.line * vinfo.yres);
+		fbdev.image = image;
+		fbdev.image_line = fbdev.line / sizeof(uint32_t);
+		fbdev.pages = 0;
+		return;
+	}
+
+	if (fbdev.vsync)
+	{
+		uint32_t crtc = 0;
+
+		if (ioctl(fbdev.fd, FBIO_WAITFORVSYNC, &crtc) < 0)
+			fbdev.vsync = false;
+	}
+
+	const uint8_t front = fbdev.back;
+	fbdev.back = (fbdev.back + 1) % fbdev.pages;
+
+	uint8_t * stale = fbdev.stale[fbdev.back];
+
+	for (uint16_t ty = 0; ty != fbdev.tiles_y; ty++)
+		for (uint16_t tx = 0; tx != fbdev.tiles_x; tx++)
+		{
+			if (!stale[ty * fbdev.tiles_x + tx])
+				continue;
+
+			uint16_t end = tx;
+			while (end != fbdev.tiles_x && stale[ty * fbdev.tiles_x + end])
+				end++;
+
+			display_rect_t rect = { tx * DISPLAY_TILE, ty * DISPLAY_TILE, end * DISPLAY_TILE, (ty + 1) * DISPLAY_TILE };
+			if (rect.x1 > vinfo.xres) rect.x1 = vinfo.xres;
+			if (rect.y1 > vinfo.yres) rect.y1 = vinfo.yres;
+
+			copy_rect((uint8_t *)fbdev_page(fbdev.back), fbdev.line, (const uint8_t *)fbdev_page(front), fbdev.line, &rect);
+			tx = end - 1;
+		}
+
+	memset(stale, 0, fbdev.tiles_x * fbdev.tiles_y);
+}
+
+static const uint32_t * fbdev_pixels(void)
+{
+	if (!fbdev.pages)
+		return fbdev.native ? (const uint32_t *)fbdev.screen : fbdev.image;
+
+	return fbdev_page((fbdev.back + fbdev.pages - 1) % fbdev.pages);
+}
+
+static void fbdev_close(void)
+{
+	if (fbdev.pages)
+	{
+		//leave the last frame on the first page, as without flipping
+		const uint8_t front = (fbdev.back + fbdev.pages - 1) % fbdev.pages;
+
+		if (front)
+			memcpy(fbdev_page(0), fbdev_page(front), (size_t)fbdev.line * vinfo.yres);
+		vinfo.yoffset = 0;
+		ioctl(fbdev.fd, FBIOPAN_DISPLAY, &vinfo);
+	}
+	for (uint8_t p = 0; p != DISPLAY_PAGES_MAX; p++)
+	{
+		free(fbdev.stale[p]);
+		fbdev.stale[p] = 0;
+	}
+	if (fbdev.screen)
+		munmap(fbdev.screen, fbdev.map);
+	if (fbdev.fd >= 0)
+		close(fbdev.fd);
+	fbdev.screen = 0;
+	fbdev.image = 0;
+	fbdev.pages = 0;
+	fbdev.fd = -1;
+}
+
+static const char * memory_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height)
+{
+	if (!parse_size(io, width, height))
+		return "Wrong size, use memory:WIDTHxHEIGHT";
+
+	if (!(memory.size = display_image_size(*width, *height)))
+		return "Image is too big!";
+
+	memory.height = *height;
+	memory.image = calloc(1, memory.size);
+
+	return memory.image ? "OK" : "Fail to allocate image!";
+}
+
+static void memory_present(const uint32_t * image, const display_damage_t * damage)
+{
+	const uint32_t line = (uint32_t)(memory.size / memory.height);
+
+	for (uint32_t r = 0; r != damage->size; r++)
+		copy_rect((uint8_t *)memory.image, line, (const uint8_t *)image, line, &damage->rect[r]);
+}
+
+static const uint32_t * memory_pixels(void)
+{
+	return memory.image;
+}
+
+static void memory_close(void)
+{
+	free(memory.image);
+	memory.image = 0;
+}
+
+static const char * null_open(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height)
+{
+	return parse_size(io, width, height) ? "OK" : "Wrong size, use null:WIDTHxHEIGHT";
+}
+
+static uint32_t * own_buffer(uint32_t * stride)
+{
+	return 0;
+}
+
+static void null_present(const uint32_t * image, const display_damage_t * damage)
+{
+}
+
+static const uint32_t * null_pixels(void)
+{
+	return 0;
+}
+
+static void null_close(void)
+{
+}
@@ -0,0 +1,50 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DISPLAY_WIDTH		1920 //default size of offscreen backends
+#define DISPLAY_HEIGHT		1080
+#define DISPLAY_PAGES_MAX	4 //page flipping, pages in video memory
+#define DISPLAY_TILE		32 //damage is tracked in tiles of this size
+#define DISPLAY_IMAGE_MAX	(UINT32_C(1) << 30) //bytes, largest 32 bit image
+
+/* Rectangle [x0, x1) x [y0, y1) */
+typedef struct
+{
+	uint16_t x0, y0, x1, y1;
+}display_rect_t;
+
+/* Pixels changed during the frame, rectangles do not overlap */
+typedef struct
+{
+	const display_rect_t * rect;
+	uint32_t size;
+}display_damage_t;
+
+/*
+ * Display backend behind framebuffer.h. Drawing goes to the 32 bit
+ * back buffer, backend presents it once per frame. The back buffer is
+ * owned by framebuffer.c unless the backend gives its own one (a page in
+ * video memory), which can change after every present.
+ */
+typedef struct
+{
+	const char * name;
+	bool raster; //false: drawing is skipped, no back buffer
+	bool visible; //real screen, frames are paced for the eye
+
+	const char * (*open)(const char * io, uint8_t multiBuffer, uint16_t * width, uint16_t * height);
+	uint32_t * (*buffer)(uint32_t * stride); //back buffer for next frame, NULL = own one, or keep the last one
+	void (*present)(const uint32_t * image, const display_damage_t * damage);
+	const uint32_t * (*pixels)(void); //last presented frame
+	void (*close)(void);
+}display_backend_t;
+
+const display_backend_t * display_select(const char * io);
+void display_vsync(bool wait);
+size_t display_image_size(uint16_t width, uint16_t height);
+
+#endif
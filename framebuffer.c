@@ -1,177 +1,989 @@
 #include "framebuffer.h"
+#include "display.h"
+#include "workers.h"
 #include <string.h>
 #include <stdlib.h>
 
-struct fb_var_screeninfo vinfo; //can be used as public
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RASTER_X86
+#elif defined(__aarch64__) || defined(__arm__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define RASTER_NEON
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#define NEON_TARGET __attribute__((target("fpu=neon")))
+#else
+#define NEON_TARGET
+#endif
+#endif
 
-static int framebuffer = 0;
-static uint32_t screenSize;
-static uint32_t * imagebuffer;
-static uint32_t * bg_buffer = 0;
+static const display_backend_t * display = 0;
+static struct
+{
+	uint16_t xres, yres;
+	uint32_t stride; //pixels per line of back buffer
+}screen;
+static uint32_t * bg_buffer = 0; //NULL if backend does not rasterize
+static uint32_t * own_buffer = 0; //back buffer when backend has no pages
+
+/*
+ * Damage of this frame. Every primitive marks tiles under its rectangle,
+ * on present runs of dirty tiles become rectangles, so the backend copies
+ * only what was drawn.
+ */
+static struct
+{
+	uint8_t * tile; //1 = changed in this frame
+	uint16_t tiles_x, tiles_y;
+	display_rect_t * rect;
+	uint32_t size;
+	uint32_t * open; //2 x tiles_x, collecting rectangles
+}damage;
 static Font_StructTypeDef * font = 0;
 
+/* Rectangle [x0, x1) x [y0, y1) primitives are clipped to */
+typedef struct
+{
+	int32_t x0, y0, x1, y1;
+}clip_t;
+static clip_t whole; //the screen
+
+/* Primitive recorded for tiled rasterization */
+typedef enum { OP_RECT, OP_CIRCLE, OP_FILLED_CIRCLE, OP_MASKED, OP_GLYPH } raster_op_t;
+typedef struct
+{
+	uint8_t op;
+	bool transparent; //glyph
+	int16_t x0, y0; //top left corner, center of circles
+	int16_t a, b; //rect: x1, y1, circles: radius, masked and glyph: size
+	uint32_t color, back;
+	const void * data; //masked: pixels, glyph: font bytes
+	const uint16_t * span; //masked: opaque part of rows
+}raster_cmd_t;
+
+/*
+ * Tiled rasterization. With more than one worker, primitives are not drawn
+ * at once but recorded and binned into every RASTER_TILE square under
+ * their box. FrameBufferFlush() sorts the bins by tile, keeping recording
+ * order, and workers draw whole tiles with each primitive clipped to the
+ * tile. Tiles share no pixels, so there are no locks, and every pixel gets
+ * the same writes in the same order as when drawn one by one: the frame
+ * does not depend on thread count. Damage is marked when recorded.
+ */
+#define RASTER_TILE		64
+
+static struct
+{
+	raster_cmd_t * cmd;
+	uint32_t cmd_s, cmd_capacity;
+	uint32_t * bin_tile, * bin_cmd; //tile and command of each bin
+	uint32_t * order; //commands sorted by tile
+	uint32_t bin_s, bin_capacity;
+	uint32_t * first; //tiles + 2, after sort tile t has order[first[t]..first[t + 1])
+	uint32_t * busy; //tiles with commands
+	uint16_t tiles_x, tiles_y;
+}tiles;
+
 static struct
 {
 	bool windowInit;
-	uint32_t * ptr;
-	uint16_t x, x_max;
+	uint16_t x0, y0, size_x, size_y; //window, may be partly off the screen
+	uint16_t x, y; //next pixel in the window
 } window = { .windowInit = false };
 
+static void Damage (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y);
+static void ResetDamage (void);
+static void CollectDamage (void);
+static void RasterInit (void);
+static void Raster (const raster_cmd_t * c, const clip_t * clip);
+static void RasterTile (void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
 
+
+/**
+ * Open display: NULL or device path for Linux framebuffer,
+ * "memory[:WxH]" for offscreen image, "null[:WxH]" for no drawing at all.
+ * multiBuffer 2..4 turns on page flipping if the device allows it.
+ */
 const char * FrameBufferInit (const char * io, uint8_t multiBuffer)
 {
-	if (io == NULL) io = "/dev/fb0"; //default to main screen
-	
-	if (framebuffer)
+	if (display)
 		return "Already initialized!";
 
-	if (bg_buffer) {
-		free(bg_buffer);
-		bg_buffer = 0;
-	}
-				
-	framebuffer = open(io, O_RDWR);
-	
-	if (framebuffer < 0)
-		return "Fail to open stream!";
-	
-	if (ioctl(framebuffer, FBIOGET_VSCREENINFO, &vinfo) < 0)
-			return "Fail get info structure!";
+	const display_backend_t * backend = display_select(io);
+	const char * result = backend->open(io, multiBuffer, &screen.xres, &screen.yres);
 
-	screenSize = vinfo.xres * vinfo.yres * vinfo.bits_per_pixel / 8;
+	if (strcmp(result, "OK"))
+		return result;
 
-	bg_buffer = malloc(screenSize);
-
-	if (multiBuffer && multiBuffer <= 4)
+	if (backend->raster)
 	{
-		vinfo.xres_virtual = vinfo.xres;
-		vinfo.yres_virtual = vinfo.yres * multiBuffer;
-		if (ioctl(framebuffer, FBIOPUT_VSCREENINFO, &vinfo) < 0)
-			return "Error set resolution";
+		//backend page in video memory or own buffer
+		if (!(bg_buffer = backend->buffer(&screen.stride)))
+		{
+			const size_t size = display_image_size(screen.xres, screen.yres);
+
+			bg_buffer = own_buffer = size ? malloc(size) : 0;
+			screen.stride = screen.xres;
+		}
+
+		damage.tiles_x = (screen.xres + DISPLAY_TILE - 1) / DISPLAY_TILE;
+		damage.tiles_y = (screen.yres + DISPLAY_TILE - 1) / DISPLAY_TILE;
+		damage.tile = malloc(damage.tiles_x * damage.tiles_y);
+		damage.rect = malloc(sizeof(display_rect_t) * damage.tiles_x * damage.tiles_y);
+		damage.open = malloc(sizeof(uint32_t) * 2 * damage.tiles_x);
+
+		tiles.tiles_x = (screen.xres + RASTER_TILE - 1) / RASTER_TILE;
+		tiles.tiles_y = (screen.yres + RASTER_TILE - 1) / RASTER_TILE;
+		tiles.first = malloc(sizeof(uint32_t) * (tiles.tiles_x * tiles.tiles_y + 2));
+		tiles.busy = malloc(sizeof(uint32_t) * tiles.tiles_x * tiles.tiles_y);
+		whole = (clip_t){ 0, 0, screen.xres, screen.yres };
+
+		if (!bg_buffer || !damage.tile || !damage.rect || !damage.open || !tiles.first || !tiles.busy)
+		{
+			FrameBufferDeInit();
+			backend->close();
+			return "Fail to allocate buffer!";
+		}
+		ResetDamage();
+		RasterInit();
 	}
 
-	imagebuffer = (void *)mmap(0, screenSize, PROT_READ | PROT_WRITE, MAP_SHARED, framebuffer, 0);
+	display = backend;
 
 	return "OK";
 }
 
+/**
+ * Present the frame, only damaged rectangles are copied
+ */
 void FrameBufferUpdate(void)
 {
-	memcpy(imagebuffer, bg_buffer, screenSize);
+	if (!bg_buffer)
+	{
+		display->present(0, 0);
+		return;
+	}
+
+	FrameBufferFlush();
+	CollectDamage();
+
+	display_damage_t frame = { damage.rect, damage.size };
+	display->present(bg_buffer, &frame);
+
+	if (!own_buffer)
+	{
+		uint32_t stride;
+		uint32_t * page = display->buffer(&stride);
+
+		if (page) //NULL: backend stopped flipping, keep drawing into the same page
+		{
+			bg_buffer = page;
+			screen.stride = stride;
+		}
+	}
+	ResetDamage();
 }
 
 void FrameBufferDeInit (void)
 {
-	munmap(bg_buffer, screenSize);
-	close(framebuffer);
-	free(bg_buffer);
-	bg_buffer = 0;
+	if (display)
+		display->close();
+	display = 0;
+	free(own_buffer);
+	free(damage.tile);
+	free(damage.rect);
+	free(damage.open);
+	bg_buffer = own_buffer = 0;
+	damage.tile = 0;
+	damage.rect = 0;
+	damage.open = 0;
+
+	free(tiles.cmd);
+	free(tiles.bin_tile);
+	free(tiles.bin_cmd);
+	free(tiles.order);
+	free(tiles.first);
+	free(tiles.busy);
+	memset(&tiles, 0, sizeof(tiles));
+}
+
+/**
+ * True if anything in the rectangle [x0, x1) x [y0, y1) was drawn in this
+ * frame, at tile precision
+ */
+bool FrameBufferDamaged (int16_t x0, int16_t y0, int16_t x1, int16_t y1)
+{
+	if (!damage.tile) return false;
+
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > screen.xres) x1 = screen.xres;
+	if (y1 > screen.yres) y1 = screen.yres;
+	if (x0 >= x1 || y0 >= y1) return false;
+
+	for (uint16_t ty = y0 / DISPLAY_TILE; ty <= (y1 - 1) / DISPLAY_TILE; ty++)
+		for (uint16_t tx = x0 / DISPLAY_TILE; tx <= (x1 - 1) / DISPLAY_TILE; tx++)
+			if (damage.tile[ty * damage.tiles_x + tx])
+				return true;
+
+	return false;
+}
+
+/**
+ * Wait for vertical blank after page flip
+ */
+void FrameBufferVSync (bool wait)
+{
+	display_vsync(wait);
+}
+
+/**
+ * Add rectangle to rows changed in this frame
+ */
+static void Damage (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y)
+{
+	uint32_t x1 = x0 + size_x > screen.xres ? screen.xres : x0 + size_x;
+	uint32_t y1 = y0 + size_y > screen.yres ? screen.yres : y0 + size_y;
+
+	if (x0 >= x1 || y0 >= y1) return;
+
+	for (uint16_t ty = y0 / DISPLAY_TILE; ty <= (y1 - 1) / DISPLAY_TILE; ty++)
+		memset(damage.tile + ty * damage.tiles_x + x0 / DISPLAY_TILE, 1, (x1 - 1) / DISPLAY_TILE - x0 / DISPLAY_TILE + 1);
+}
+
+static void ResetDamage (void)
+{
+	memset(damage.tile, 0, damage.tiles_x * damage.tiles_y);
+	damage.size = 0;
+}
+
+/**
+ * Runs of dirty tiles in a tile row become rectangles, a run with
+ * the same columns as a rectangle ending on the row above extends it down
+ */
+static void CollectDamage (void)
+{
+	uint32_t * open = damage.open, * next = damage.open + damage.tiles_x; //rectangles ending on the row above, by x
+	uint16_t open_s = 0;
+
+	damage.size = 0;
+	for (uint16_t ty = 0; ty != damage.tiles_y; ty++)
+	{
+		const uint8_t * tile = damage.tile + ty * damage.tiles_x;
+		const uint16_t y0 = ty * DISPLAY_TILE, y1 = y0 + DISPLAY_TILE > screen.yres ? screen.yres : y0 + DISPLAY_TILE;
+		uint16_t o = 0, next_s = 0;
+
+		for (uint16_t tx = 0; tx != damage.tiles_x; tx++)
+		{
+			if (!tile[tx])
+				continue;
+
+			uint16_t end = tx;
+			while (end != damage.tiles_x && tile[end])
+				end++;
+
+			const uint16_t x0 = tx * DISPLAY_TILE, x1 = end * DISPLAY_TILE > screen.xres ? screen.xres : end * DISPLAY_TILE;
+			tx = end - 1;
+
+			while (o != open_s && damage.rect[open[o]].x0 < x0)
+				o++;
+
+			if (o != open_s && damage.rect[open[o]].x0 == x0 && damage.rect[open[o]].x1 == x1)
+			{
+				damage.rect[open[o]].y1 = y1;
+				next[next_s++] = open[o];
+			}
+			else
+			{
+				damage.rect[damage.size] = (display_rect_t){ x0, y0, x1, y1 };
+				next[next_s++] = damage.size++;
+			}
+		}
+
+		uint32_t * t = open; open = next; next = t;
+		open_s = next_s;
+	}
+}
+
+/**
+ * Name of display backend in use
+ */
+const char * FrameBufferBackend (void)
+{
+	return display ? display->name : "none";
+}
+
+/**
+ * True if frames go to a real screen
+ */
+bool FrameBufferVisible (void)
+{
+	return display && display->visible;
+}
+
+/**
+ * True if primitives draw anything
+ */
+bool FrameBufferRaster (void)
+{
+	return bg_buffer != 0;
+}
+
+/**
+ * Last presented frame, 32 bit pixels, NULL for null backend
+ */
+const uint32_t * FrameBufferPixels (void)
+{
+	return display ? display->pixels() : 0;
+}
+
+/*
+ * Rasterization core. Primitives take signed coordinates, are clipped to
+ * the screen once, mark damage once for their clipped box and then fill
+ * whole rows with a vector span fill.
+ */
+static void (* span_fill)(uint32_t * dst, uint32_t n, uint32_t color);
+static void (* glyph_fill)(uint32_t * dst, uint32_t stride, const uint8_t * glyph, uint32_t fg, uint32_t bg, bool transparent);
+
+/*
+ * Rows of 8x8 glyphs are bytes, bit 0 is the left pixel. A byte is
+ * expanded by table into 8 masks, all ones where the bit is set, and a
+ * row is written at once as base ^ ((fg ^ base) & mask). Base is the back
+ * color, or the screen itself for transparent text.
+ */
+static uint32_t glyph_mask[256][8] __attribute__((aligned(32)));
+
+static void span_scalar (uint32_t * dst, uint32_t n, uint32_t color)
+{
+	while (n--)
+		*dst++ = color;
+}
+
+#ifdef RASTER_X86
+__attribute__((target("sse2")))
+static void span_sse (uint32_t * dst, uint32_t n, uint32_t color)
+{
+	for (; n && ((uintptr_t)dst & 15); n--) //align to 16 bytes
+		*dst++ = color;
+
+	const __m128i c = _mm_set1_epi32(color);
+	for (; n >= 16; n -= 16, dst += 16)
+	{
+		_mm_store_si128((__m128i *)dst, c);
+		_mm_store_si128((__m128i *)dst + 1, c);
+		_mm_store_si128((__m128i *)dst + 2, c);
+		_mm_store_si128((__m128i *)dst + 3, c);
+	}
+	for (; n >= 4; n -= 4, dst += 4)
+		_mm_store_si128((__m128i *)dst, c);
+
+	span_scalar(dst, n, color);
+}
+#endif
+
+#ifdef RASTER_NEON
+NEON_TARGET
+static void span_neon (uint32_t * dst, uint32_t n, uint32_t color)
+{
+	const uint32x4_t c = vdupq_n_u32(color);
+	for (; n >= 16; n -= 16, dst += 16)
+	{
+		vst1q_u32(dst, c);
+		vst1q_u32(dst + 4, c);
+		vst1q_u32(dst + 8, c);
+		vst1q_u32(dst + 12, c);
+	}
+	for (; n >= 4; n -= 4, dst += 4)
+		vst1q_u32(dst, c);
+
+	span_scalar(dst, n, color);
+}
+#endif
+
+static void glyph_scalar (uint32_t * dst, uint32_t stride, const uint8_t * glyph, uint32_t fg, uint32_t bg, bool transparent)
+{
+	for (uint8_t y = 0; y != 8; y++, dst += stride)
+	{
+		const uint32_t * m = glyph_mask[glyph[y]];
+
+		for (uint8_t x = 0; x != 8; x++)
+		{
+			const uint32_t base = transparent ? dst[x] : bg;
+			dst[x] = base ^ ((fg ^ base) & m[x]);
+		}
+	}
+}
+
+#ifdef RASTER_X86
+__attribute__((target("sse2")))
+static void glyph_sse (uint32_t * dst, uint32_t stride, const uint8_t * glyph, uint32_t fg, uint32_t bg, bool transparent)
+{
+	const __m128i f = _mm_set1_epi32(fg);
+	__m128i b0 = _mm_set1_epi32(bg), b1 = b0;
+
+	for (uint8_t y = 0; y != 8; y++, dst += stride)
+	{
+		const __m128i * m = (const __m128i *)glyph_mask[glyph[y]];
+
+		if (transparent)
+		{
+			b0 = _mm_loadu_si128((__m128i *)dst);
+			b1 = _mm_loadu_si128((__m128i *)dst + 1);
+		}
+		_mm_storeu_si128((__m128i *)dst, _mm_xor_si128(b0, _mm_and_si128(_mm_xor_si128(f, b0), _mm_load_si128(m))));
+		_mm_storeu_si128((__m128i *)dst + 1, _mm_xor_si128(b1, _mm_and_si128(_mm_xor_si128(f, b1), _mm_load_si128(m + 1))));
+	}
+}
+#endif
+
+#ifdef RASTER_NEON
+NEON_TARGET
+static void glyph_neon (uint32_t * dst, uint32_t stride, const uint8_t * glyph, uint32_t fg, uint32_t bg, bool transparent)
+{
+	const uint32x4_t f = vdupq_n_u32(fg);
+	uint32x4_t b0 = vdupq_n_u32(bg), b1 = b0;
+
+	for (uint8_t y = 0; y != 8; y++, dst += stride)
+	{
+		const uint32_t * m = glyph_mask[glyph[y]];
+
+		if (transparent)
+		{
+			b0 = vld1q_u32(dst);
+			b1 = vld1q_u32(dst + 4);
+		}
+		vst1q_u32(dst, vbslq_u32(vld1q_u32(m), f, b0));
+		vst1q_u32(dst + 4, vbslq_u32(vld1q_u32(m + 4), f, b1));
+	}
+}
+#endif
+
+/**
+ * Pick span fill and glyph fill for this CPU
+ */
+static void RasterInit (void)
+{
+	span_fill = span_scalar;
+	glyph_fill = glyph_scalar;
+
+	for (uint16_t b = 0; b != 256; b++)
+		for (uint8_t x = 0; x != 8; x++)
+			glyph_mask[b][x] = (b >> x) & 1 ? UINT32_MAX : 0;
+
+#ifdef RASTER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		span_fill = span_sse;
+		glyph_fill = glyph_sse;
+	}
+#endif
+
+#ifdef RASTER_NEON
+#if defined(__arm__)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+	{
+		span_fill = span_neon;
+		glyph_fill = glyph_neon;
+	}
+#endif
+}
+
+/**
+ * Clip rectangle [x0, x1) x [y0, y1), false if nothing left
+ */
+static bool Clip (const clip_t * clip, int32_t * x0, int32_t * y0, int32_t * x1, int32_t * y1)
+{
+	if (*x0 < clip->x0) *x0 = clip->x0;
+	if (*y0 < clip->y0) *y0 = clip->y0;
+	if (*x1 > clip->x1) *x1 = clip->x1;
+	if (*y1 > clip->y1) *y1 = clip->y1;
+
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+/**
+ * Row [x0, x1) of y, damage is already marked by the caller
+ */
+static inline void Row (const clip_t * clip, int32_t x0, int32_t y, int32_t x1, uint32_t color)
+{
+	if (y < clip->y0 || y >= clip->y1) return;
+	if (x0 < clip->x0) x0 = clip->x0;
+	if (x1 > clip->x1) x1 = clip->x1;
+	if (x0 < x1)
+		span_fill(bg_buffer + x0 + screen.stride * y, x1 - x0, color);
+}
+
+static void RasterRect (const clip_t * clip, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+	if (!Clip(clip, &x0, &y0, &x1, &y1)) return;
+
+	for (uint32_t * dst = bg_buffer + x0 + screen.stride * y0; y0 != y1; y0++, dst += screen.stride)
+		span_fill(dst, x1 - x0, color);
+}
+
+static void RasterCircle (const clip_t * clip, int32_t x0, int32_t y0, int32_t r, uint32_t color)
+{
+	int32_t x = -r, y = 0, err = 2 - 2 * r, e2;
+	do {
+		const int32_t px[2] = { x0 - x, x0 + x }, py[2] = { y0 + y, y0 - y };
+		for (uint8_t i = 0; i != 4; i++)
+			if (px[i & 1] >= clip->x0 && px[i & 1] < clip->x1 && py[i >> 1] >= clip->y0 && py[i >> 1] < clip->y1)
+				bg_buffer[px[i & 1] + screen.stride * py[i >> 1]] = color;
+		e2 = err;
+		if (e2 <= y) {
+			err += ++y * 2 + 1;
+			if (-x == y && e2 <= x) e2 = 0;
+		}
+		if (e2 > x) err += ++x * 2 + 1;
+	} while (x <= 0);
+}
+
+/**
+ * Rows are filled once, on the first step of each y where the span
+ * is the widest
+ */
+static void RasterFilledCircle (const clip_t * clip, int32_t x0, int32_t y0, int32_t r, uint32_t color)
+{
+	int32_t x = -r, y = 0, err = 2 - 2 * r, e2, last = -1;
+	do {
+		if (y != last)
+		{
+			Row(clip, x0 + x, y0 + y, x0 - x, color);
+			if (y)
+				Row(clip, x0 + x, y0 - y, x0 - x, color);
+			last = y;
+		}
+		e2 = err;
+		if (e2 <= y) {
+			err += ++y * 2 + 1;
+			if (-x == y && e2 <= x) e2 = 0;
+		}
+		if (e2 > x) err += ++x * 2 + 1;
+	} while (x <= 0);
+}
+
+static void RasterMasked (const clip_t * clip, int32_t x0, int32_t y0, uint16_t size_x, uint16_t size_y, const uint32_t * pic, const uint16_t * span)
+{
+	int32_t cx0 = x0, cy0 = y0, cx1 = x0 + size_x, cy1 = y0 + size_y;
+
+	if (!Clip(clip, &cx0, &cy0, &cx1, &cy1)) return;
+
+	for (int32_t y = cy0; y != cy1; y++)
+	{
+		const uint16_t * s = span + 2 * (y - y0);
+		int32_t b = x0 + s[0], e = x0 + s[1];
+
+		if (b < cx0) b = cx0;
+		if (e > cx1) e = cx1;
+		if (b < e)
+			memcpy(bg_buffer + b + screen.stride * y, pic + (b - x0) + size_x * (y - y0), sizeof(uint32_t) * (e - b));
+	}
+}
+
+/**
+ * Whole 8x8 glyph inside of the clip goes to glyph_fill, others pixel by
+ * pixel: glyph pixel (x, y) is bit k % size_y of byte k / size_y,
+ * k = x + y * size_x.
+ */
+static void RasterGlyph (const clip_t * clip, const raster_cmd_t * c)
+{
+	const int32_t x0 = c->x0, y0 = c->y0;
+	int32_t cx0 = x0, cy0 = y0, x1 = x0 + c->a, y1 = y0 + c->b;
+	const uint8_t * glyph = c->data;
+
+	if (!Clip(clip, &cx0, &cy0, &x1, &y1)) return;
+
+	if (c->a == 8 && c->b == 8 && cx0 == x0 && cy0 == y0 && x1 - x0 == 8 && y1 - y0 == 8)
+	{
+		glyph_fill(bg_buffer + x0 + screen.stride * y0, screen.stride, glyph, c->color, c->back, c->transparent);
+		return;
+	}
+
+	for (int32_t y = cy0; y != y1; y++)
+		for (int32_t x = cx0; x != x1; x++)
+		{
+			uint16_t k = (x - x0) + (y - y0) * c->a;
+			bool set = glyph[k / c->b] & (1 << (k % c->b));
+
+			if (set || !c->transparent)
+				bg_buffer[x + screen.stride * y] = set ? c->color : c->back;
+		}
+}
+
+/**
+ * Draw primitive inside of the clip
+ */
+static void Raster (const raster_cmd_t * c, const clip_t * clip)
+{
+	switch (c->op)
+	{
+	case OP_RECT:
+		RasterRect(clip, c->x0, c->y0, c->a, c->b, c->color);
+		break;
+	case OP_CIRCLE:
+		RasterCircle(clip, c->x0, c->y0, c->a, c->color);
+		break;
+	case OP_FILLED_CIRCLE:
+		RasterFilledCircle(clip, c->x0, c->y0, c->a, c->color);
+		break;
+	case OP_MASKED:
+		RasterMasked(clip, c->x0, c->y0, c->a, c->b, c->data, c->span);
+		break;
+	case OP_GLYPH:
+		RasterGlyph(clip, c);
+		break;
+	}
+}
+
+/**
+ * Room for one more command with bins more bins, false if there is no
+ * memory
+ */
+static bool Reserve (uint32_t bins)
+{
+	if (tiles.cmd_s == tiles.cmd_capacity)
+	{
+		uint32_t capacity = tiles.cmd_capacity ? tiles.cmd_capacity * 2 : 1024;
+		raster_cmd_t * cmd = realloc(tiles.cmd, sizeof(raster_cmd_t) * capacity);
+
+		if (!cmd) return false;
+		tiles.cmd = cmd;
+		tiles.cmd_capacity = capacity;
+	}
+
+	if (tiles.bin_s + bins > tiles.bin_capacity)
+	{
+		uint32_t capacity = tiles.bin_capacity ? tiles.bin_capacity * 2 : 4096;
+
+		while (capacity < tiles.bin_s + bins)
+			capacity *= 2;
+
+		//each one is kept when it grew, capacity only when all did
+		uint32_t * tile = realloc(tiles.bin_tile, sizeof(uint32_t) * capacity);
+		if (tile) tiles.bin_tile = tile;
+		uint32_t * cmd = realloc(tiles.bin_cmd, sizeof(uint32_t) * capacity);
+		if (cmd) tiles.bin_cmd = cmd;
+		uint32_t * order = realloc(tiles.order, sizeof(uint32_t) * capacity);
+		if (order) tiles.order = order;
+
+		if (!tile || !cmd || !order) return false;
+		tiles.bin_capacity = capacity;
+	}
+
+	return true;
+}
+
+/**
+ * Draw primitive now, or record it for the tiles under its box. Box
+ * [x0, x1) x [y0, y1) is clipped to the screen and marked as damaged.
+ */
+static void Submit (const raster_cmd_t * c, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	if (workers_count() == 1)
+	{
+		Raster(c, &whole);
+		return;
+	}
+
+	const uint32_t tx0 = x0 / RASTER_TILE, ty0 = y0 / RASTER_TILE, tx1 = (x1 - 1) / RASTER_TILE, ty1 = (y1 - 1) / RASTER_TILE;
+
+	if (!Reserve((tx1 - tx0 + 1) * (ty1 - ty0 + 1)))
+	{
+		FrameBufferFlush(); //recorded ones go first
+		Raster(c, &whole);
+		return;
+	}
+
+	for (uint32_t ty = ty0; ty <= ty1; ty++)
+		for (uint32_t tx = tx0; tx <= tx1; tx++)
+		{
+			tiles.bin_tile[tiles.bin_s] = ty * tiles.tiles_x + tx;
+			tiles.bin_cmd[tiles.bin_s++] = tiles.cmd_s;
+		}
+	tiles.cmd[tiles.cmd_s++] = *c;
+}
+
+/**
+ * Draw recorded primitives, tiles in parallel. Pixels read by a
+ * primitive (masked image, glyph font) must be valid until then.
+ */
+void FrameBufferFlush (void)
+{
+	if (!tiles.cmd_s) return;
+
+	const uint32_t count = tiles.tiles_x * tiles.tiles_y;
+	uint32_t * first = tiles.first, busy_s = 0;
+
+	//counting sort by tile, stable
+	memset(first, 0, sizeof(uint32_t) * (count + 2));
+	for (uint32_t i = 0; i != tiles.bin_s; i++)
+		first[tiles.bin_tile[i] + 2]++;
+	for (uint32_t t = 0; t != count; t++)
+	{
+		if (first[t + 2])
+			tiles.busy[busy_s++] = t;
+		first[t + 2] += first[t + 1];
+	}
+	for (uint32_t i = 0; i != tiles.bin_s; i++)
+		tiles.order[first[tiles.bin_tile[i] + 1]++] = tiles.bin_cmd[i];
+
+	workers_run(RasterTile, 0, busy_s, 1);
+
+	tiles.cmd_s = 0;
+	tiles.bin_s = 0;
+}
+
+/**
+ * Commands of busy tiles [begin, end) in recording order
+ */
+static void RasterTile (void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t i = begin; i != end; i++)
+	{
+		const uint32_t t = tiles.busy[i];
+		clip_t clip = { t % tiles.tiles_x * RASTER_TILE, t / tiles.tiles_x * RASTER_TILE, 0, 0 };
+
+		clip.x1 = clip.x0 + RASTER_TILE > screen.xres ? screen.xres : clip.x0 + RASTER_TILE;
+		clip.y1 = clip.y0 + RASTER_TILE > screen.yres ? screen.yres : clip.y0 + RASTER_TILE;
+
+		for (uint32_t k = tiles.first[t]; k != tiles.first[t + 1]; k++)
+			Raster(&tiles.cmd[tiles.order[k]], &clip);
+	}
+}
+
+static void FillRect (int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+	if (!Clip(&whole, &x0, &y0, &x1, &y1)) return;
+
+	Damage(x0, y0, x1 - x0, y1 - y0);
+	Submit(&(raster_cmd_t){ .op = OP_RECT, .x0 = x0, .y0 = y0, .a = x1, .b = y1, .color = color }, x0, y0, x1, y1);
+}
+
+/**
+ * Copy image of size_x x size_y, parts outside of the screen are skipped.
+ * Caller owns the image, so it is drawn at once.
+ */
+static void Blit (int32_t x0, int32_t y0, uint16_t size_x, uint16_t size_y, const uint32_t * pic)
+{
+	int32_t x1 = x0 + size_x, y1 = y0 + size_y;
+	const int32_t px = x0, py = y0;
+
+	if (!Clip(&whole, &x0, &y0, &x1, &y1)) return;
+
+	FrameBufferFlush();
+	Damage(x0, y0, x1 - x0, y1 - y0);
+	for (; y0 != y1; y0++)
+		memcpy(bg_buffer + x0 + screen.stride * y0, pic + (x0 - px) + size_x * (y0 - py), sizeof(uint32_t) * (x1 - x0));
 }
 
 void ClearScreen (uint32_t color)
 {
-	for (uint32_t i = 0; i < (vinfo.xres * vinfo.yres); i++)
-		*(bg_buffer + i) = color;
+	if (!bg_buffer) return;
+
+	FillRect(0, 0, screen.xres, screen.yres, color);
 }
 
+/**
+ * Window for FillWindow(), pixels outside of the screen are skipped
+ */
 void SetWindow (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y)
 {
+	int32_t x1 = x0 + size_x, y1 = y0 + size_y, cx0 = x0, cy0 = y0;
+
+	window.windowInit = false;
+	if (!bg_buffer || !size_x || !size_y) return;
+
 	window.windowInit = true;
-	window.ptr = bg_buffer + (x0 + vinfo.xres * y0);
-	window.x_max = size_x;
+	window.x0 = x0;
+	window.y0 = y0;
+	window.size_x = size_x;
+	window.size_y = size_y;
+	window.x = window.y = 0;
+	if (!Clip(&whole, &cx0, &cy0, &x1, &y1)) return;
+
+	FrameBufferFlush();
+	Damage(cx0, cy0, x1 - cx0, y1 - cy0);
 }
 
+/**
+ * Next pixel of the window, row by row
+ */
 void FillWindow (uint32_t color)
 {
-	if (window.windowInit == false) return;
+	if (window.windowInit == false || window.y == window.size_y) return;
 
-	*window.ptr++ = color;
-	window.x++;
+	const uint32_t x = window.x0 + window.x, y = window.y0 + window.y;
 
-	if (window.x < window.x_max)
-		return;
+	if (x < screen.xres && y < screen.yres)
+		bg_buffer[x + screen.stride * y] = color;
 
-	window.x = 0;
-	window.ptr += vinfo.xres - window.x_max;
+	if (++window.x == window.size_x)
+	{
+		window.x = 0;
+		window.y++;
+	}
 }
 
 void FlushWindow (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y, uint32_t * color)
 {
-	SetWindow(x0, y0, size_x, size_y);
-	for (uint32_t i = 0; i < size_x * size_y; i++)
-		FillWindow(color[i]);
+	if (!bg_buffer) return;
+
+	Blit(x0, y0, size_x, size_y, color);
 }
 
 void DrawPic32 (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y, uint32_t * pic)
 {
-	for (uint16_t y = 0; y < size_y; y++)
-		for (uint16_t x = 0; x < size_x; x++)
-			*(bg_buffer + (x + x0 + vinfo.xres * (y0 + y))) = *pic++;
+	if (!bg_buffer) return;
+
+	Blit(x0, y0, size_x, size_y, pic);
 }
 
 void DrawPixel32 (uint16_t x0, uint16_t y0, uint32_t color)
 {
-	*(bg_buffer + (x0 + vinfo.xres * y0 )) = color;
+	if (!bg_buffer || x0 >= screen.xres || y0 >= screen.yres) return;
+
+	FrameBufferFlush();
+	Damage(x0, y0, 1, 1);
+	*(bg_buffer + (x0 + screen.stride * y0 )) = color;
+}
+
+/**
+ * Single pixels, point is y << 16 | x. Drawn at once, binning them would
+ * cost as much as drawing.
+ */
+void DrawPoints32 (const uint32_t * point, const uint32_t * color, uint32_t n)
+{
+	if (!bg_buffer) return;
+
+	FrameBufferFlush();
+	for (uint32_t i = 0; i != n; i++)
+	{
+		const uint16_t x = point[i] & 0xFFFF, y = point[i] >> 16;
+
+		if (x >= screen.xres || y >= screen.yres) continue;
+
+		damage.tile[y / DISPLAY_TILE * damage.tiles_x + x / DISPLAY_TILE] = 1;
+		bg_buffer[x + screen.stride * y] = color[i];
+	}
+}
+
+void FillPoints32 (const uint32_t * point, uint32_t n, uint32_t color)
+{
+	if (!bg_buffer) return;
+
+	FrameBufferFlush();
+	for (uint32_t i = 0; i != n; i++)
+	{
+		const uint16_t x = point[i] & 0xFFFF, y = point[i] >> 16;
+
+		if (x >= screen.xres || y >= screen.yres) continue;
+
+		damage.tile[y / DISPLAY_TILE * damage.tiles_x + x / DISPLAY_TILE] = 1;
+		bg_buffer[x + screen.stride * y] = color;
+	}
+}
+
+/**
+ * Copy image where row y has opaque pixels [span[2 * y], span[2 * y + 1]),
+ * parts outside of the screen are skipped. Image and spans are read until
+ * FrameBufferFlush().
+ */
+void DrawMasked32 (int16_t x0, int16_t y0, uint16_t size_x, uint16_t size_y, const uint32_t * pic, const uint16_t * span)
+{
+	int32_t cx0 = x0, cy0 = y0, cx1 = x0 + size_x, cy1 = y0 + size_y;
+
+	if (!bg_buffer || !Clip(&whole, &cx0, &cy0, &cx1, &cy1)) return;
+
+	Damage(cx0, cy0, cx1 - cx0, cy1 - cy0);
+	Submit(&(raster_cmd_t){ .op = OP_MASKED, .x0 = x0, .y0 = y0, .a = size_x, .b = size_y, .data = pic, .span = span }, \
+		cx0, cy0, cx1, cy1);
+}
+
+/**
+ * Line [x0, x1) of y0, coordinates may be outside of the screen
+ */
+static void HorizontalSpan (int32_t x0, int32_t y0, int32_t x1, uint32_t color)
+{
+	if (x0 > x1) { int32_t t = x0; x0 = x1; x1 = t; }
+
+	FillRect(x0, y0, x1, y0 + 1, color);
+}
+
+static void VerticalSpan (int32_t x0, int32_t y0, int32_t y1, uint32_t color)
+{
+	if (y0 > y1) { int32_t t = y0; y0 = y1; y1 = t; }
+
+	FillRect(x0, y0, x0 + 1, y1, color);
 }
 
 void DrawHorizontalLine32 (uint16_t x0, uint16_t y0, uint16_t x1, uint32_t color)
 {
-	uint16_t dx = x1 > x0 ? x1 - x0 : x0 - x1;
-	SetWindow(x0, y0, dx, 1);
-	while(dx--)
-			FillWindow(color);
+	if (!bg_buffer) return;
+
+	HorizontalSpan(x0, y0, x1, color);
 }
 
 void DrawVerticalLine32 (uint16_t x0, uint16_t y0, uint16_t y1, uint32_t color)
 {
-	uint16_t dy = y1 > y0 ? y1 - y0 : y0 - y1;
-	SetWindow(x0, y0, 1, dy);
-	while(dy--)
-		FillWindow(color);
+	if (!bg_buffer) return;
+
+	VerticalSpan(x0, y0, y1, color);
+}
+
+/**
+ * Rectangle [x0, x1) x [y0, y1)
+ */
+void DrawFilledRect32 (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint32_t color)
+{
+	if (!bg_buffer) return;
+
+	FillRect(x0, y0, x1, y1, color);
+}
+
+/**
+ * Record circle with its box clipped to the screen and damaged, nothing
+ * if it is off the screen
+ */
+static void Circle (uint8_t op, int32_t x0, int32_t y0, int32_t r, uint32_t color)
+{
+	int32_t bx0 = x0 - r, by0 = y0 - r, bx1 = x0 + r + 1, by1 = y0 + r + 1;
+
+	if (!Clip(&whole, &bx0, &by0, &bx1, &by1)) return;
+
+	Damage(bx0, by0, bx1 - bx0, by1 - by0);
+	Submit(&(raster_cmd_t){ .op = op, .x0 = x0, .y0 = y0, .a = r, .color = color }, bx0, by0, bx1, by1);
 }
 
 void DrawCircle32(int16_t x0, int16_t y0, int16_t r, uint32_t color)
 {
-    int16_t x = -r, y = 0, err = 2 - 2 * r, e2;
-    do {
-    	DrawPixel32(x0 - x, y0 + y, color);
-    	DrawPixel32(x0 + x, y0 + y, color);
-    	DrawPixel32(x0 + x, y0 - y, color);
-    	DrawPixel32(x0 - x, y0 - y, color);
-        e2 = err;
-        if (e2 <= y) {
-            err += ++y * 2 + 1;
-            if (-x == y && e2 <= x) e2 = 0;
-        }
-        if (e2 > x) err += ++x * 2 + 1;
-    } while (x <= 0);
+	if (!bg_buffer || r < 0) return;
+
+	Circle(OP_CIRCLE, x0, y0, r, color);
 }
 
 void DrawFilledCircle32 (int16_t x0, int16_t y0, int16_t r, uint32_t color)
 {
-    int16_t x = -r, y = 0, err = 2 - 2 * r, e2;
-    do {
-    	DrawHorizontalLine32(x0 + x, y0 + y, x0 - x, color);
-    	DrawHorizontalLine32(x0 + x, y0 - y, x0 - x, color);
-        e2 = err;
-        if (e2 <= y) {
-            err += ++y * 2 + 1;
-            if (-x == y && e2 <= x) e2 = 0;
-        }
-        if (e2 > x) err += ++x * 2 + 1;
-    } while (x <= 0);
+	if (!bg_buffer || r < 0) return;
+
+	Circle(OP_FILLED_CIRCLE, x0, y0, r, color);
 }
 
 void GetScreenSize (uint16_t * width, uint16_t * height)
 {
-	*width = vinfo.xres;
-	*height = vinfo.yres;
+	*width = screen.xres;
+	*height = screen.yres;
 }
 
 void DrawCross (uint16_t x0, uint16_t y0, uint16_t size, uint32_t color)
 {
-	DrawHorizontalLine32(x0 - size, y0, x0 + size, color);
-	DrawVerticalLine32(x0, y0 - size, y0 + size, color);
+	if (!bg_buffer) return;
+
+	HorizontalSpan(x0 - size, y0, x0 + size, color);
+	VerticalSpan(x0, y0 - size, y0 + size, color);
 }
 
 Font_StructTypeDef * SetFont (Font_StructTypeDef * _font)
@@ -182,15 +994,27 @@ Font_StructTypeDef * SetFont (Font_StructTypeDef * _font)
 
 static void PrintChar (uint16_t x0, uint16_t y0, char ch)
 {
-	SetWindow(x0, y0, font->FontXsize, font->FontYsize);
-	for (uint8_t x = 0; x != font->FontXsize; x++)
-		for (uint8_t y = 0; y != font->FontYsize; y++)
-			FillWindow ((font->Font[ch * font->FontXsize + x] & (1 << y)) ? font->FontColor : font->BackColor);
+	int32_t cx0 = x0, cy0 = y0, x1 = x0 + font->FontXsize, y1 = y0 + font->FontYsize;
+
+	if (!Clip(&whole, &cx0, &cy0, &x1, &y1)) return;
+
+	Damage(cx0, cy0, x1 - cx0, y1 - cy0);
+	Submit(&(raster_cmd_t){ .op = OP_GLYPH, .transparent = font->Transparent, .x0 = x0, .y0 = y0, \
+		.a = font->FontXsize, .b = font->FontYsize, .color = font->FontColor, .back = font->BackColor, \
+		.data = font->Font + ((uint8_t)ch & 0x7F) * font->FontXsize }, cx0, cy0, x1, y1); //128 glyphs
 }
 
 uint16_t PrintText (uint16_t x0, uint16_t y0, const char * text)
 {
 	uint16_t x = x0, Row = 0;
+
+	if (!bg_buffer) //still count rows
+	{
+		for (; * text; text++)
+			Row += * text == '\n';
+		return Row;
+	}
+
 	while(* text)
 	{
 		if (* text == '\n')
@@ -31,19 +31,31 @@ typedef struct
 	uint8_t FontXsize, FontYsize;
 	const uint8_t * Font;
 	uint32_t FontColor, BackColor;
+	bool Transparent; //BackColor is not drawn
 }Font_StructTypeDef;
 
 const char * FrameBufferInit (const char * io, uint8_t multiBuffer);
 void FrameBufferUpdate(void);
 void FrameBufferDeInit (void);
+void FrameBufferVSync (bool wait);
+bool FrameBufferDamaged (int16_t x0, int16_t y0, int16_t x1, int16_t y1);
+const char * FrameBufferBackend (void);
+bool FrameBufferVisible (void);
+bool FrameBufferRaster (void);
+void FrameBufferFlush (void);
+const uint32_t * FrameBufferPixels (void);
 void ClearScreen (uint32_t color);
 void SetWindow (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y);
 void FillWindow (uint32_t color);
 void FlushWindow (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y, uint32_t * color);
 void DrawPic32 (uint16_t x0, uint16_t y0, uint16_t size_x, uint16_t size_y, uint32_t * pic);
 void DrawPixel32 (uint16_t x0, uint16_t y0, uint32_t color);
+void DrawPoints32 (const uint32_t * point, const uint32_t * color, uint32_t n);
+void FillPoints32 (const uint32_t * point, uint32_t n, uint32_t color);
+void DrawMasked32 (int16_t x0, int16_t y0, uint16_t size_x, uint16_t size_y, const uint32_t * pic, const uint16_t * span);
 void DrawHorizontalLine32 (uint16_t x0, uint16_t y0, uint16_t x1, uint32_t color);
 void DrawVerticalLine32 (uint16_t x0, uint16_t y0, uint16_t y1, uint32_t color);
+void DrawFilledRect32 (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint32_t color);
 void DrawCircle32(int16_t x0, int16_t y0, int16_t r, uint32_t color);
 void DrawFilledCircle32 (int16_t x0, int16_t y0, int16_t r, uint32_t color);
 void GetScreenSize (uint16_t * width, uint16_t * height);
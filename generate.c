@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "generate.h"
+#include "framebuffer.h"
+#include "workers.h"
+
+#define GENERATE_CHUNK		1024 //bodies per grab of a worker
+#define GENERATE_TRIES		64 //rejection sampling gives up after that, keeps the last draw
+
+static const uint16_t radius[] = { 2, 5 }; // min, max
+static const uint16_t speed_x10[] = { 1, 10 }; // min, max
+static const uint16_t weight[] = { 10, 50 }; // min, max
+static const uint32_t colors[] = { WHITE32, RED32, GREEN32, BLUE32, YELLOW32, CYAN32, MAGENTA32, SILVER32, GRAY32, MAROON32, OLIVE32 };
+static const char * names[] = { "SUN", "MERCURY", "VENUS", "EARTH", "MARS", "JUPITER", "SATURN", "URANUS", "NEPTUNE" };
+
+/*
+ * Random numbers are Philox4x32-10 of counter (body, draw) and key
+ * (seed, stream): every body gets its own sequence that depends only on
+ * its index, so bodies are generated in parallel in any order and the
+ * result does not depend on the thread count.
+ */
+typedef struct
+{
+	uint32_t key[2];
+	uint32_t body, draw;
+	uint32_t block[4]; //current output
+	uint8_t used;
+}random_t;
+
+typedef struct
+{
+	bodies_t * bodies;
+	model_t model;
+	uint32_t amount, seed;
+	uint16_t width, height; //screen
+	double cx, cy; //center of the model
+	double scale, mass; //length scale and total mass
+}generate_t;
+
+/* Philox4x32-10 known answers from Random123: counter, key, output */
+static const uint32_t known[3][10] =
+{
+	{ 0, 0, 0, 0, 0, 0, 0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8 },
+	{ 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD },
+	{ 0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344, 0xA4093822, 0x299F31D0, 0xD16CFE09, 0x94FDCCEB, 0x5001E420, 0x24126EA1 },
+};
+
+/* Functions */
+static void generate_setup(generate_t * g, bodies_t * bodies, model_t model, uint32_t amount, uint32_t seed, \
+	uint16_t width, uint16_t height);
+static void generate_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void uniform(const generate_t * g, uint32_t i, random_t * rnd, object_t * object);
+static void plummer(random_t * rnd, double a, double mass, double * p);
+static void disk(const generate_t * g, random_t * rnd, object_t * object);
+static void random_start(random_t * rnd, uint32_t seed, uint32_t stream, uint32_t body);
+static uint32_t random_u32(random_t * rnd);
+static double random_uniform(random_t * rnd);
+static void philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+/**
+ * Allocate bodies and fill them with amount objects of the model, on the
+ * workers. Same seed gives the same bodies for any number of threads.
+ */
+bool generate(bodies_t * bodies, model_t model, uint32_t amount, uint32_t seed, uint16_t width, uint16_t height)
+{
+	generate_t g;
+
+	if (!bodies_alloc(bodies, amount))
+		return false;
+
+	generate_setup(&g, bodies, model, amount, seed, width, height);
+	workers_run(generate_job, &g, amount, GENERATE_CHUNK);
+	return true;
+}
+
+/**
+ * Self-check: Philox known answers, then the same bodies generated on the
+ * workers and on this thread alone, bit for bit. Returns "OK" or error.
+ */
+const char * generate_check(model_t model, uint32_t amount, uint32_t seed, uint16_t width, uint16_t height)
+{
+	bodies_t all = { 0 }, one = { 0 };
+	generate_t g;
+	uint32_t out[4];
+
+	for (uint8_t k = 0; k != sizeof(known) / sizeof(known[0]); k++)
+	{
+		philox(known[k], known[k] + 4, out);
+		if (memcmp(out, known[k] + 6, sizeof(out)))
+			return "Philox known answer mismatch!";
+	}
+
+	if (!generate(&all, model, amount, seed, width, height) || !bodies_alloc(&one, amount))
+	{
+		bodies_free(&all);
+		return "Fail to allocate bodies!";
+	}
+
+	generate_setup(&g, &one, model, amount, seed, width, height);
+	generate_job(&g, 0, amount, 0);
+
+	bool same = !memcmp(all.x, one.x, sizeof(double) * amount) && !memcmp(all.y, one.y, sizeof(double) * amount) && \
+		!memcmp(all.vx, one.vx, sizeof(double) * amount) && !memcmp(all.vy, one.vy, sizeof(double) * amount) && \
+		!memcmp(all.m, one.m, sizeof(double) * amount);
+
+	for (uint32_t i = 0; i != amount && same; i++)
+		same = all.info[i].r == one.info[i].r && all.info[i].color == one.info[i].color && \
+			!strcmp(all.info[i].name, one.info[i].name);
+
+	bodies_free(&all);
+	bodies_free(&one);
+
+	return same ? "OK" : "Bodies depend on the thread count!";
+}
+
+static void generate_setup(generate_t * g, bodies_t * bodies, model_t model, uint32_t amount, uint32_t seed, \
+	uint16_t width, uint16_t height)
+{
+	*g = (generate_t){ .bodies = bodies, .model = model, .amount = amount, .seed = seed, .width = width, .height = height, \
+		.cx = width / 2, .cy = height / 2, .scale = GENERATE_SPACING * sqrt(amount), .mass = amount };
+}
+
+static void generate_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const generate_t * g = ctx;
+
+	for (uint32_t i = begin; i != end; i++)
+	{
+		object_t object = { .r = 1, .weight = g->mass / g->amount };
+		random_t rnd;
+		double p[4];
+
+		random_start(&rnd, g->seed, g->model, i);
+
+		switch (g->model)
+		{
+		case MODEL_UNIFORM:
+			uniform(g, i, &rnd, &object);
+			break;
+		case MODEL_PLUMMER:
+			plummer(&rnd, g->scale, g->mass, p);
+			object.x = g->cx + p[0];
+			object.y = g->cy + p[1];
+			object.vx = p[2];
+			object.vy = p[3];
+			object.color = hypot(p[0], p[1]) < g->scale ? YELLOW32 : WHITE32;
+			break;
+		case MODEL_DISK:
+			disk(g, &rnd, &object);
+			break;
+		case MODEL_MERGER:
+		{
+			//two Plummer spheres of half the mass on a bound, slightly off center collision course
+			const bool second = i >= g->amount / 2;
+			const double a = g->scale / 2, d = 2 * g->scale, half = g->mass / 2;
+			const double v = 0.3 * sqrt(2 * G * g->mass / (2 * d)); //of each, well below escape
+
+			plummer(&rnd, a, half, p);
+			object.x = g->cx + p[0] + (second ? d : -d);
+			object.y = g->cy + p[1] + (second ? -a : a) / 2;
+			object.vx = p[2] + (second ? -v : v);
+			object.vy = p[3];
+			object.color = second ? CYAN32 : RED32;
+			break;
+		}
+		}
+
+		bodies_set(g->bodies, i, &object);
+	}
+}
+
+/**
+ * Uniform over the screen with independent random speeds, the classic
+ * random objects. Generated name is written to the body.
+ */
+static void uniform(const generate_t * g, uint32_t i, random_t * rnd, object_t * object)
+{
+	object->r = random_u32(rnd) % (radius[1] - radius[0]) + radius[0];
+	object->x = random_u32(rnd) % (g->width - 2 * object->r) + object->r;
+	object->y = random_u32(rnd) % (g->height - 2 * object->r) + object->r;
+	object->vx = random_u32(rnd) % (speed_x10[1] - speed_x10[0]) + speed_x10[0];
+	object->vy = random_u32(rnd) % (speed_x10[1] - speed_x10[0]) + speed_x10[0];
+	object->color = colors[random_u32(rnd) % (sizeof(colors) / sizeof(colors[0]))];
+	object->weight = random_u32(rnd) % (weight[1] - weight[0]) + weight[0];
+
+	if (i < (sizeof(names) / sizeof(*names)))
+		object->name = names[i];
+	else
+	{
+		snprintf(g->bodies->info[i].name, BODY_NAME_SIZE, "Object %u", i);
+		object->name = g->bodies->info[i].name;
+	}
+
+	object->vx *= random_u32(rnd) & 1 ? 1 : -1;
+	object->vy *= random_u32(rnd) & 1 ? 1 : -1;
+}
+
+/**
+ * Plummer sphere of scale a and mass projected on the plane: position
+ * from the cumulative mass, speed from the distribution function by
+ * rejection (Aarseth, Henon, Wielen 1974), both isotropic in 3D.
+ * p is x, y, vx, vy around the center.
+ */
+static void plummer(random_t * rnd, double a, double mass, double * p)
+{
+	double r, q = 0, g;
+
+	//radius, far halo (beyond 10 a, about 0.15% of the mass) is cut
+	for (uint8_t t = 0; t != GENERATE_TRIES; t++)
+		if ((r = a / sqrt(pow(random_uniform(rnd), -2.0 / 3) - 1)) < 10 * a)
+			break;
+
+	for (uint8_t t = 0; t != GENERATE_TRIES; t++)
+	{
+		q = random_uniform(rnd);
+		g = q * q * pow(1 - q * q, 3.5);
+		if (0.1 * random_uniform(rnd) < g)
+			break;
+	}
+	const double v = q * sqrt(2 * G * mass) * pow(r * r + a * a, -0.25);
+
+	//isotropic directions, z is dropped
+	for (uint8_t k = 0; k != 2; k++)
+	{
+		const double z = 2 * random_uniform(rnd) - 1, phi = 2 * M_PI * random_uniform(rnd);
+		const double s = (k ? v : r) * sqrt(1 - z * z);
+
+		p[2 * k] = s * cos(phi);
+		p[2 * k + 1] = s * sin(phi);
+	}
+}
+
+/**
+ * Exponential disk of scale length h = scale / 3 on circular orbits, speed
+ * from the mass inside the radius as if it was a point in the center
+ */
+static void disk(const generate_t * g, random_t * rnd, object_t * object)
+{
+	const double h = g->scale / 3;
+	double r = 0;
+
+	//surface density exp(-r / h): radius is gamma(2) distributed, cut at 10 h
+	for (uint8_t t = 0; t != GENERATE_TRIES; t++)
+		if ((r = -h * log(random_uniform(rnd) * random_uniform(rnd))) < 10 * h)
+			break;
+
+	const double phi = 2 * M_PI * random_uniform(rnd);
+	const double inside = g->mass * (1 - (1 + r / h) * exp(-r / h));
+	const double v = sqrt(G * inside / r);
+
+	object->x = g->cx + r * cos(phi);
+	object->y = g->cy + r * sin(phi);
+	object->vx = -v * sin(phi); //counterclockwise
+	object->vy = v * cos(phi);
+	object->color = r < h ? YELLOW32 : r < 3 * h ? WHITE32 : BLUE32;
+}
+
+static void random_start(random_t * rnd, uint32_t seed, uint32_t stream, uint32_t body)
+{
+	rnd->key[0] = seed;
+	rnd->key[1] = stream;
+	rnd->body = body;
+	rnd->draw = 0;
+	rnd->used = 4;
+}
+
+static uint32_t random_u32(random_t * rnd)
+{
+	if (rnd->used == 4)
+	{
+		const uint32_t counter[4] = { rnd->body, rnd->draw++, 0, 0 };
+
+		philox(counter, rnd->key, rnd->block);
+		rnd->used = 0;
+	}
+	return rnd->block[rnd->used++];
+}
+
+/**
+ * Uniform in (0, 1), never 0 or 1
+ */
+static double random_uniform(random_t * rnd)
+{
+	return (random_u32(rnd) + 0.5) / 4294967296.0;
+}
+
+/**
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+ * 1, 2, 3", SC 2011)
+ */
+static void philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (uint8_t round = 0; round != 10; round++)
+	{
+		const uint64_t p0 = (uint64_t)0xD2511F53 * c0, p1 = (uint64_t)0xCD9E8D57 * c2;
+
+		c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		c1 = (uint32_t)p1;
+		c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c3 = (uint32_t)p0;
+
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
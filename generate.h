@@ -0,0 +1,14 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+#include "space.h"
+
+#define GENERATE_SPACING	10 //model scale is spacing * sqrt(bodies), density does not depend on count
+
+bool generate(bodies_t * bodies, model_t model, uint32_t amount, uint32_t seed, uint16_t width, uint16_t height);
+const char * generate_check(model_t model, uint32_t amount, uint32_t seed, uint16_t width, uint16_t height);
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "impacts.h"
+
+#define IMPACTS_ALIGN		64 //cache line, producer and consumer indexes do not share it
+
+/*
+ * Merges go from the simulation to own thread through a lock-free single
+ * producer, single consumer ring. Only the simulation thread writes
+ * head, only the consumer writes tail; a slot is handed over by the
+ * release store of head and given back by the release store of tail.
+ * The simulation never waits: a merge that finds the ring full is
+ * dropped and counted. The consumer prints merges in the old text form
+ * and writes them to the file as CSV lines:
+ * step,survivor,absorbed,survivor_mass,absorbed_mass,x,y
+ * with ids of bodies and masses before the merge.
+ */
+static struct
+{
+	impact_record_t * ring;
+	char (* name)[BODY_NAME_SIZE]; //by id, names do not change
+	FILE * out;
+	bool print, open;
+	pthread_t thread;
+
+	//producer side
+	uint64_t head __attribute__((aligned(IMPACTS_ALIGN)));
+	uint64_t tail_seen; //last tail loaded, saves loads of the shared line
+	uint64_t dropped;
+
+	//consumer side
+	uint64_t tail __attribute__((aligned(IMPACTS_ALIGN)));
+	bool quit;
+}impacts;
+
+/* Functions */
+static void * consumer_thread(void * arg);
+
+/**
+ * Start the consumer: merges are printed if print is set and written
+ * to file if it is not NULL. Returns "OK" or error.
+ */
+const char * impacts_open(const bodies_t * bodies, const char * file, bool print)
+{
+	const uint32_t n = bodies->capacity;
+
+	impacts_close(NULL, NULL);
+
+	impacts.ring = malloc(sizeof(impact_record_t) * IMPACTS_RING);
+	impacts.name = malloc(BODY_NAME_SIZE * (n ? n : 1));
+	if (!impacts.ring || !impacts.name)
+	{
+		impacts_close(NULL, NULL);
+		return "Fail to allocate impact ring!";
+	}
+
+	for (uint32_t id = 0; id != n; id++)
+		if (bodies->slot[id] != BODIES_NONE)
+			memcpy(impacts.name[id], bodies->info[bodies->slot[id]].name, BODY_NAME_SIZE);
+		else
+			impacts.name[id][0] = 0;
+
+	if (file)
+	{
+		if (!(impacts.out = fopen(file, "w")))
+		{
+			impacts_close(NULL, NULL);
+			return "Fail to open impact file!";
+		}
+		fprintf(impacts.out, "step,survivor,absorbed,survivor_mass,absorbed_mass,x,y\n");
+	}
+
+	impacts.print = print;
+	impacts.head = impacts.tail = impacts.tail_seen = 0;
+	impacts.dropped = 0;
+	impacts.quit = false;
+	if (pthread_create(&impacts.thread, NULL, consumer_thread, NULL))
+	{
+		impacts_close(NULL, NULL);
+		return "Fail to start impact consumer!";
+	}
+	impacts.open = true;
+
+	return "OK";
+}
+
+/**
+ * Merge to the ring, from the simulation thread only. Never waits.
+ */
+void impacts_record(const impact_record_t * record)
+{
+	if (!impacts.open)
+		return;
+
+	const uint64_t head = impacts.head;
+
+	if (head - impacts.tail_seen == IMPACTS_RING)
+	{
+		impacts.tail_seen = __atomic_load_n(&impacts.tail, __ATOMIC_ACQUIRE);
+		if (head - impacts.tail_seen == IMPACTS_RING)
+		{
+			impacts.dropped++;
+			return;
+		}
+	}
+
+	impacts.ring[head & (IMPACTS_RING - 1)] = *record;
+	__atomic_store_n(&impacts.head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Let the consumer take what is left in the ring and stop it. Counts of
+ * merges recorded and dropped can be NULL.
+ */
+void impacts_close(uint64_t * events, uint64_t * dropped)
+{
+	if (impacts.open)
+	{
+		__atomic_store_n(&impacts.quit, true, __ATOMIC_RELEASE);
+		pthread_join(impacts.thread, NULL);
+		impacts.open = false;
+	}
+
+	if (impacts.out)
+		fclose(impacts.out);
+	impacts.out = NULL;
+
+	if (events) *events = impacts.head;
+	if (dropped) *dropped = impacts.dropped;
+
+	free(impacts.ring);
+	free(impacts.name);
+	impacts.ring = NULL;
+	impacts.name = NULL;
+}
+
+/**
+ * Takes all merges published so far, sleeps when there are none
+ */
+static void * consumer_thread(void * arg)
+{
+	uint64_t tail = impacts.tail;
+
+	while (1)
+	{
+		//quit is read before head, so merges recorded before close are seen
+		const bool quit = __atomic_load_n(&impacts.quit, __ATOMIC_ACQUIRE);
+		const uint64_t head = __atomic_load_n(&impacts.head, __ATOMIC_ACQUIRE);
+
+		if (tail == head)
+		{
+			if (quit)
+				break;
+
+			if (impacts.print)
+				fflush(stdout);
+			nanosleep(&(struct timespec){ 0, IMPACTS_IDLE_US * 1000 }, NULL);
+			continue;
+		}
+
+		for (; tail != head; tail++)
+		{
+			const impact_record_t * r = &impacts.ring[tail & (IMPACTS_RING - 1)];
+
+			if (impacts.print)
+				printf("Impact between %s and %s\n", impacts.name[r->survivor], impacts.name[r->absorbed]);
+			if (impacts.out)
+				fprintf(impacts.out, "%llu,%u,%u,%.17g,%.17g,%.17g,%.17g\n", (unsigned long long)r->step, \
+					r->survivor, r->absorbed, r->survivor_mass, r->absorbed_mass, r->x, r->y);
+		}
+
+		__atomic_store_n(&impacts.tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return arg;
+}
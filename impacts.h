@@ -0,0 +1,24 @@
+#ifndef IMPACTS_H
+#define IMPACTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+#define IMPACTS_RING		65536 //merges waiting for the consumer, power of two
+#define IMPACTS_IDLE_US		1000 //consumer sleep when the ring is empty
+
+/* One merge: absorbed body joined the survivor during step */
+typedef struct
+{
+	uint64_t step;
+	uint32_t survivor, absorbed; //ids
+	double survivor_mass, absorbed_mass; //before the merge
+	double x, y; //where it happened, survivor position
+}impact_record_t;
+
+const char * impacts_open(const bodies_t * bodies, const char * file, bool print);
+void impacts_record(const impact_record_t * record);
+void impacts_close(uint64_t * events, uint64_t * dropped);
+
+#endif
@@ -1,17 +1,260 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include "framebuffer.h"
+#include "display.h"
+#include "space.h"
+#include "workers.h"
+
+static void usage(const char * name)
+{
+	printf("Usage: %s [-g exact|tree|pm|simd] [-t theta] [-m grid] [-c tolerance] [-d dt] [-k levels] [-e eta] [-r steps] [-j threads] [-o display] [-f pages] [-w]\n" \
+		"       [-s seed] [-u uniform|plummer|disk|merger] [-n steps] [-b file] [-i] [-z zoom] [-l radius] [-p rate] [-x file] [-X file]\n" \
+		"       [-T file[:every][:raw|float|delta][:drop]] [-I file] [objects|scenario]\n", name);
+	printf("  objects  amount of random objects, scenario  CSV or binary file with bodies,\n");
+	printf("           see scenario.c, without either predefined objects are used\n");
+	printf("  -g  gravity engine, exact all pairs (default), Barnes-Hut tree, particle-mesh\n");
+	printf("      or vectorized all pairs\n");
+	printf("  -t  tree opening angle (default %.2f), smaller is more accurate\n", space_options.theta);
+	printf("  -m  particle-mesh grid (default %u), power of two\n", space_options.pm_grid);
+	printf("  -c  check engine against exact gravity on first step, and generator of random objects\n");
+	printf("  -d  time step (default %.2f), impacts are swept so bigger steps do not miss them\n", space_options.dt);
+	printf("  -k  block time steps dt / 2^level, level 0..%u (default 0, one step for all)\n", SPACE_LEVELS_MAX);
+	printf("  -e  block time step accuracy (default %.2f), step <= eta * sqrt(radius / acceleration)\n", space_options.eta);
+	printf("  -r  sort bodies in memory by position every N steps (default never)\n");
+	printf("  -j  worker threads (default one per CPU), results do not depend on it\n");
+	printf("  -o  display: framebuffer device (default /dev/fb0), memory[:WxH] offscreen image\n");
+	printf("      or null[:WxH] without drawing, offscreen runs at full speed\n");
+	printf("  -f  page flipping on framebuffer device with 2..%u pages, copy if driver refuses\n", DISPLAY_PAGES_MAX);
+	printf("  -w  wait for vertical blank after page flip\n");
+	printf("  -s  seed of random objects (default %u)\n", space_options.seed);
+	printf("  -u  model of random objects: uniform over the screen (default), Plummer sphere,\n");
+	printf("      rotating exponential disk or merger of two spheres; same for any -j\n");
+	printf("  -n  stop after N steps (default never)\n");
+	printf("  -b  benchmark: no waiting, append steps per second and p50/p99 time of each\n");
+	printf("      stage to file as one JSON line (\"-\" for stdout), needs -n\n");
+	printf("  -i  statistics overlay in the top left corner\n");
+	printf("  -z  zoom around the mass center (default %.2f), screen pixels per unit of space\n", space_options.zoom);
+	printf("  -l  bodies smaller than radius in pixels (default %.2f) are splatted as points\n", space_options.splat);
+	printf("      colored by mass, draw time then grows with pixels, not with bodies\n");
+	printf("  -p  steps per second on a screen (default %.0f), 0 = as fast as possible; frames are\n", space_options.rate);
+	printf("      drawn by own thread at %u fps between the last two steps\n", SPACE_FRAME_RATE);
+	printf("  -x  save checkpoint to file when the run stops (after -n steps)\n");
+	printf("  -X  resume from checkpoint file instead of creating objects\n");
+	printf("  -T  record id, position, speed and mass of bodies every N steps (default 1) to file,\n");
+	printf("      as double, float or quantized deltas; written by own thread, a full buffer makes\n");
+	printf("      the simulation wait, or with drop skips the frame\n");
+	printf("  -I  write merges to file as CSV: step, ids of survivor and absorbed body, their masses,\n");
+	printf("      position; passed to own thread without locks, merges over a full queue are dropped\n");
+}
+
+/**
+ * Integer option: not a number or below min is an error, above max is max
+ */
+static bool option_number(const char * text, long long min, long long max, long long * value)
+{
+	char * end;
+	const long long v = strtoll(text, &end, 10);
+
+	if (end == text || *end || v < min)
+		return false;
+
+	*value = v > max ? max : v;
+	return true;
+}
 
 int main(int argc, char** argv)
 {
-	printf("Framebuffer: %s\n", FrameBufferInit(0, 0));
+	int opt;
+	uint8_t threads = 0;
+	const char * display = 0;
+	uint8_t pages = 0;
+	bool vsync = false;
+	uint32_t objects = 0;
+	const char * result;
+	long long value;
+
+	while ((opt = getopt(argc, argv, "g:t:m:c:d:k:e:r:j:o:f:ws:u:n:b:iz:l:p:x:X:T:I:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'g':
+			if (!strcmp(optarg, "exact"))
+				space_options.gravity = GRAVITY_EXACT;
+			else if (!strcmp(optarg, "tree"))
+				space_options.gravity = GRAVITY_TREE;
+			else if (!strcmp(optarg, "pm"))
+				space_options.gravity = GRAVITY_PM;
+			else if (!strcmp(optarg, "simd"))
+				space_options.gravity = GRAVITY_SIMD;
+			else
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't':
+			space_options.theta = atof(optarg);
+			break;
+		case 'm':
+			space_options.pm_grid = atoi(optarg);
+			if (space_options.pm_grid < 8 || space_options.pm_grid > 4096 || \
+				(space_options.pm_grid & (space_options.pm_grid - 1)))
+			{
+				printf("Grid must be power of two 8..4096\n");
+				return 1;
+			}
+			break;
+		case 'c':
+			space_options.tolerance = atof(optarg);
+			break;
+		case 'd':
+			space_options.dt = atof(optarg);
+			break;
+		case 'k':
+			if (!option_number(optarg, 0, SPACE_LEVELS_MAX, &value))
+			{
+				printf("Levels must be 0..%u\n", SPACE_LEVELS_MAX);
+				return 1;
+			}
+			space_options.levels = value;
+			break;
+		case 'e':
+			space_options.eta = atof(optarg);
+			break;
+		case 'r':
+			if (!option_number(optarg, 0, UINT32_MAX, &value))
+			{
+				printf("Reorder must be 0..%u steps, 0 = never\n", UINT32_MAX);
+				return 1;
+			}
+			space_options.reorder = value;
+			break;
+		case 'j':
+			if (!option_number(optarg, 0, WORKERS_MAX, &value))
+			{
+				printf("Threads must be 0..%u, 0 = one per CPU\n", WORKERS_MAX);
+				return 1;
+			}
+			threads = value;
+			break;
+		case 'o':
+			display = optarg;
+			break;
+		case 'f':
+			if (!option_number(optarg, 0, DISPLAY_PAGES_MAX, &value))
+			{
+				printf("Pages must be 2..%u, 0 = no flipping\n", DISPLAY_PAGES_MAX);
+				return 1;
+			}
+			pages = value;
+			break;
+		case 'w':
+			vsync = true;
+			break;
+		case 's':
+			if (!option_number(optarg, 0, UINT32_MAX, &value))
+			{
+				printf("Seed must be 0..%u\n", UINT32_MAX);
+				return 1;
+			}
+			space_options.seed = value;
+			break;
+		case 'u':
+			if (!strcmp(optarg, "uniform"))
+				space_options.model = MODEL_UNIFORM;
+			else if (!strcmp(optarg, "plummer"))
+				space_options.model = MODEL_PLUMMER;
+			else if (!strcmp(optarg, "disk"))
+				space_options.model = MODEL_DISK;
+			else if (!strcmp(optarg, "merger"))
+				space_options.model = MODEL_MERGER;
+			else
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			if (!option_number(optarg, 0, LLONG_MAX, &value))
+			{
+				printf("Steps must be 0 or more, 0 = never stop\n");
+				return 1;
+			}
+			space_options.steps = value;
+			break;
+		case 'b':
+			space_options.bench = optarg;
+			break;
+		case 'i':
+			space_options.overlay = true;
+			break;
+		case 'z':
+			space_options.zoom = atof(optarg);
+			if (space_options.zoom <= 0)
+			{
+				printf("Zoom must be above 0\n");
+				return 1;
+			}
+			break;
+		case 'l':
+			space_options.splat = atof(optarg);
+			break;
+		case 'p':
+			space_options.rate = atof(optarg);
+			break;
+		case 'x':
+			space_options.checkpoint = optarg;
+			break;
+		case 'X':
+			space_options.resume = optarg;
+			break;
+		case 'T':
+			space_options.trajectory = optarg;
+			break;
+		case 'I':
+			space_options.impacts = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	//number of random objects or scenario file
+	if (optind < argc)
+	{
+		char * end;
+
+		objects = strtoul(argv[optind], &end, 10);
+		if (*end)
+			space_options.scenario = argv[optind];
+	}
+
+	if (!workers_init(threads))
+	{
+		printf("Fail to start worker threads\n");
+		return 1;
+	}
+	printf("Workers: %u\n", workers_count());
+
+	result = FrameBufferInit(display, pages);
+	printf("Framebuffer: %s (%s)\n", result, FrameBufferBackend());
+	if (strcmp(result, "OK"))
+	{
+		workers_deinit();
+		return 1;
+	}
+	FrameBufferVSync(vsync);
 
-	extern void space_init (uint16_t objects, uint32_t backColor);
-	space_init(argc == 2 ? atoi(argv[1]) : 0, BLACK32);
+	const bool ok = space_init(objects, BLACK32);
 
 	FrameBufferDeInit();
+	workers_deinit();
 
-	return 0;
+	return ok ? 0 : 1;
 }
@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "morton.h"
+#include "workers.h"
+
+/* Reorder scratch, kept between calls */
+static struct
+{
+	uint32_t * key, * key_tmp;
+	uint32_t * order, * order_tmp; //old slot of each new slot
+	void * buffer; //one permuted array
+	uint32_t capacity;
+
+	//current call
+	bodies_t * bodies;
+	double ox, oy, scale;
+	void * src;
+	size_t item;
+}morton;
+
+/* Functions */
+static uint32_t spread(uint32_t v);
+static void radix_sort(uint32_t n);
+static void permute(void * array, size_t item, uint32_t n);
+static void key_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void permute_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Sort bodies along Z-order curve of their position. Dead bodies are
+ * dropped from the store, their ids map to BODIES_NONE (the renderer
+ * keeps its own state by id). Order of equal keys is kept (stable sort).
+ * Returns false if out of memory, bodies stay in place then.
+ */
+bool morton_reorder(bodies_t * bodies)
+{
+	uint32_t n = 0;
+	double x_min = INFINITY, x_max = -INFINITY, y_min = INFINITY, y_max = -INFINITY;
+
+	if (bodies->size > morton.capacity)
+	{
+		morton_free();
+		morton.capacity = bodies->size;
+		morton.key = malloc(sizeof(uint32_t) * morton.capacity);
+		morton.key_tmp = malloc(sizeof(uint32_t) * morton.capacity);
+		morton.order = malloc(sizeof(uint32_t) * morton.capacity);
+		morton.order_tmp = malloc(sizeof(uint32_t) * morton.capacity);
+		morton.buffer = malloc((sizeof(body_info_t) > sizeof(double) ? sizeof(body_info_t) : sizeof(double)) * morton.capacity);
+
+		if (!morton.key || !morton.key_tmp || !morton.order || !morton.order_tmp || !morton.buffer)
+		{
+			morton_free();
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		if (!bodies->alive[i])
+			continue;
+
+		morton.order[n++] = i;
+
+		if (bodies->x[i] < x_min) x_min = bodies->x[i];
+		if (bodies->x[i] > x_max) x_max = bodies->x[i];
+		if (bodies->y[i] < y_min) y_min = bodies->y[i];
+		if (bodies->y[i] > y_max) y_max = bodies->y[i];
+	}
+
+	if (n == 0)
+		return true;
+
+	morton.bodies = bodies;
+	morton.ox = x_min;
+	morton.oy = y_min;
+	morton.scale = 65535 / fmax(fmax(x_max - x_min, y_max - y_min), 1e-9);
+
+	workers_run(key_job, NULL, n, 4096);
+	radix_sort(n);
+
+	permute(bodies->x, sizeof(double), n);
+	permute(bodies->y, sizeof(double), n);
+	permute(bodies->vx, sizeof(double), n);
+	permute(bodies->vy, sizeof(double), n);
+	permute(bodies->ax, sizeof(double), n);
+	permute(bodies->ay, sizeof(double), n);
+	permute(bodies->m, sizeof(double), n);
+	permute(bodies->x0, sizeof(double), n);
+	permute(bodies->y0, sizeof(double), n);
+	permute(bodies->alive, sizeof(uint8_t), n);
+	permute(bodies->level, sizeof(uint8_t), n);
+	permute(bodies->info, sizeof(body_info_t), n);
+	permute(bodies->id, sizeof(uint32_t), n);
+
+	for (uint32_t i = 0; i != bodies->capacity; i++)
+		bodies->slot[i] = BODIES_NONE;
+
+	for (uint32_t i = 0; i != n; i++)
+		bodies->slot[bodies->id[i]] = i;
+
+	bodies->size = n;
+	return true;
+}
+
+/**
+ * Release reorder scratch
+ */
+void morton_free(void)
+{
+	free(morton.key);
+	free(morton.key_tmp);
+	free(morton.order);
+	free(morton.order_tmp);
+	free(morton.buffer);
+	memset(&morton, 0, sizeof(morton));
+}
+
+/**
+ * Put 16 bits of v to even bit positions
+ */
+static uint32_t spread(uint32_t v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static void key_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const bodies_t * bodies = morton.bodies;
+
+	for (uint32_t k = begin; k != end; k++)
+	{
+		uint32_t i = morton.order[k];
+		uint32_t x = (bodies->x[i] - morton.ox) * morton.scale;
+		uint32_t y = (bodies->y[i] - morton.oy) * morton.scale;
+
+		morton.key[k] = spread(x) | (spread(y) << 1);
+	}
+}
+
+/**
+ * LSD radix sort of (key, order) pairs, 8 bits per pass.
+ * Passes where all keys have the same digit are skipped.
+ */
+static void radix_sort(uint32_t n)
+{
+	for (uint8_t shift = 0; shift != 32; shift += 8)
+	{
+		uint32_t count[256] = { 0 };
+
+		for (uint32_t k = 0; k != n; k++)
+			count[(morton.key[k] >> shift) & 0xFF]++;
+
+		if (count[(morton.key[0] >> shift) & 0xFF] == n)
+			continue;
+
+		for (uint32_t d = 0, sum = 0; d != 256; d++)
+		{
+			uint32_t c = count[d];
+			count[d] = sum;
+			sum += c;
+		}
+
+		for (uint32_t k = 0; k != n; k++)
+		{
+			uint32_t dst = count[(morton.key[k] >> shift) & 0xFF]++;
+			morton.key_tmp[dst] = morton.key[k];
+			morton.order_tmp[dst] = morton.order[k];
+		}
+
+		uint32_t * t = morton.key;
+		morton.key = morton.key_tmp;
+		morton.key_tmp = t;
+
+		t = morton.order;
+		morton.order = morton.order_tmp;
+		morton.order_tmp = t;
+	}
+}
+
+/**
+ * array[k] = array[order[k]] for k < n
+ */
+static void permute(void * array, size_t item, uint32_t n)
+{
+	morton.src = array;
+	morton.item = item;
+	workers_run(permute_job, NULL, n, 4096);
+	memcpy(array, morton.buffer, item * n);
+}
+
+static void permute_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const uint8_t * src = morton.src;
+	uint8_t * dst = morton.buffer;
+	const size_t item = morton.item;
+
+	switch (item)
+	{
+	case sizeof(double):
+		for (uint32_t k = begin; k != end; k++)
+			((double *)dst)[k] = ((const double *)src)[morton.order[k]];
+		break;
+	case sizeof(uint32_t):
+		for (uint32_t k = begin; k != end; k++)
+			((uint32_t *)dst)[k] = ((const uint32_t *)src)[morton.order[k]];
+		break;
+	case sizeof(uint8_t):
+		for (uint32_t k = begin; k != end; k++)
+			dst[k] = src[morton.order[k]];
+		break;
+	default:
+		for (uint32_t k = begin; k != end; k++)
+			memcpy(dst + k * item, src + morton.order[k] * item, item);
+		break;
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+bool morton_reorder(bodies_t * bodies);
+void morton_free(void);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <string.h>
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_X86
+#elif defined(__aarch64__) || defined(__arm__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define PIXEL_NEON
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#define NEON_TARGET __attribute__((target("fpu=neon")))
+#else
+#define NEON_TARGET
+#endif
+#endif
+
+/*
+ * Conversion of the 32 bit back buffer to the pixel format of a screen,
+ * used on present for damaged rectangles only. Common formats have own
+ * kernels (RGB565 and RGB888 vectorized), any other 16/24/32 bit
+ * format with up to 8 bits per color goes through the generic one.
+ * Pixels are stored in host byte order, as the framebuffer expects.
+ */
+static pixel_format_t generic; //format of the generic converter
+
+static void copy32 (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	memcpy(dst, src, sizeof(uint32_t) * n);
+}
+
+static void rgb565_scalar (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	for (; n; n--, src++, dst += 2)
+	{
+		const uint16_t v = (*src >> 8 & 0xF800) | (*src >> 5 & 0x07E0) | (*src >> 3 & 0x001F);
+		memcpy(dst, &v, sizeof(v));
+	}
+}
+
+static void rgb888_scalar (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	for (; n; n--, src++, dst += 3)
+	{
+		dst[0] = *src;
+		dst[1] = *src >> 8;
+		dst[2] = *src >> 16;
+	}
+}
+
+static void generic_scalar (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	const uint8_t bytes = generic.bpp / 8;
+
+	for (; n; n--, src++, dst += bytes)
+	{
+		uint32_t v = 0;
+
+		for (uint8_t c = 0; c != 3; c++)
+			v |= (uint32_t)((*src >> (16 - 8 * c)) & 0xFF) >> (8 - generic.length[c]) << generic.offset[c];
+		for (uint8_t b = 0; b != bytes; b++)
+			dst[b] = v >> (8 * b);
+	}
+}
+
+#ifdef PIXEL_X86
+__attribute__((target("sse2")))
+static inline __m128i rgb565_pack (__m128i p)
+{
+	p = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800)), \
+		_mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0))), _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F)));
+
+	//sign extend, so saturating pack keeps all 16 bits
+	return _mm_srai_epi32(_mm_slli_epi32(p, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static void rgb565_sse (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	for (; n >= 8; n -= 8, src += 8, dst += 16)
+	{
+		const __m128i a = rgb565_pack(_mm_loadu_si128((const __m128i *)src));
+		const __m128i b = rgb565_pack(_mm_loadu_si128((const __m128i *)src + 1));
+
+		_mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(a, b));
+	}
+
+	rgb565_scalar(dst, src, n);
+}
+
+__attribute__((target("ssse3")))
+static void rgb888_ssse3 (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	//16 bytes are stored for 12, the rest is written by the next step
+	for (; n >= 6; n -= 4, src += 4, dst += 12)
+		_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle));
+
+	rgb888_scalar(dst, src, n);
+}
+#endif
+
+#ifdef PIXEL_NEON
+NEON_TARGET
+static void rgb565_neon (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	const uint32x4_t r = vdupq_n_u32(0xF800), g = vdupq_n_u32(0x07E0), b = vdupq_n_u32(0x001F);
+
+	for (; n >= 8; n -= 8, src += 8, dst += 16)
+	{
+		uint32x4_t p0 = vld1q_u32(src), p1 = vld1q_u32(src + 4);
+
+		p0 = vorrq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(p0, 8), r), vandq_u32(vshrq_n_u32(p0, 5), g)), vandq_u32(vshrq_n_u32(p0, 3), b));
+		p1 = vorrq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(p1, 8), r), vandq_u32(vshrq_n_u32(p1, 5), g)), vandq_u32(vshrq_n_u32(p1, 3), b));
+		vst1q_u16((uint16_t *)dst, vcombine_u16(vmovn_u32(p0), vmovn_u32(p1)));
+	}
+
+	rgb565_scalar(dst, src, n);
+}
+
+NEON_TARGET
+static void rgb888_neon (uint8_t * dst, const uint32_t * src, uint32_t n)
+{
+	for (; n >= 8; n -= 8, src += 8, dst += 24)
+	{
+		uint8x8x4_t p = vld4_u8((const uint8_t *)src); //b, g, r, x planes
+		uint8x8x3_t q = { { p.val[0], p.val[1], p.val[2] } };
+
+		vst3_u8(dst, q);
+	}
+
+	rgb888_scalar(dst, src, n);
+}
+#endif
+
+/**
+ * True if the format is the one of the back buffer, 32 bit 0x00RRGGBB
+ */
+bool pixel_native(const pixel_format_t * format)
+{
+	const uint8_t * o = format->offset, * l = format->length;
+
+	return format->bpp == 32 && o[0] == 16 && o[1] == 8 && o[2] == 0 && l[0] == 8 && l[1] == 8 && l[2] == 8;
+}
+
+/**
+ * Converter for the format, NULL if it is not supported. Name tells the
+ * format and kernel.
+ */
+pixel_convert_t pixel_converter(const pixel_format_t * format, const char ** name)
+{
+	const uint8_t * o = format->offset, * l = format->length;
+	pixel_convert_t convert = 0;
+
+	if (format->bpp != 16 && format->bpp != 24 && format->bpp != 32)
+		return 0;
+	for (uint8_t c = 0; c != 3; c++)
+		if (!l[c] || l[c] > 8 || o[c] + l[c] > format->bpp)
+			return 0;
+
+	if (pixel_native(format))
+	{
+		*name = "xrgb8888";
+		return copy32;
+	}
+
+	if (format->bpp == 16 && o[0] == 11 && o[1] == 5 && o[2] == 0 && l[0] == 5 && l[1] == 6 && l[2] == 5)
+	{
+		*name = "rgb565";
+		convert = rgb565_scalar;
+#ifdef PIXEL_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+		{
+			*name = "rgb565 sse2";
+			convert = rgb565_sse;
+		}
+#endif
+#ifdef PIXEL_NEON
+#if defined(__arm__)
+		if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+		{
+			*name = "rgb565 neon";
+			convert = rgb565_neon;
+		}
+#endif
+		return convert;
+	}
+
+	if (format->bpp == 24 && o[0] == 16 && o[1] == 8 && o[2] == 0 && l[0] == 8 && l[1] == 8 && l[2] == 8)
+	{
+		*name = "rgb888";
+		convert = rgb888_scalar;
+#ifdef PIXEL_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("ssse3"))
+		{
+			*name = "rgb888 ssse3";
+			convert = rgb888_ssse3;
+		}
+#endif
+#ifdef PIXEL_NEON
+#if defined(__arm__)
+		if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+		{
+			*name = "rgb888 neon";
+			convert = rgb888_neon;
+		}
+#endif
+		return convert;
+	}
+
+	generic = *format;
+	*name = "generic";
+	return generic_scalar;
+}
@@ -0,0 +1,20 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Pixel format of a screen, as in fb_var_screeninfo */
+typedef struct
+{
+	uint8_t bpp; //16, 24 or 32
+	uint8_t offset[3], length[3]; //bits of red, green, blue
+}pixel_format_t;
+
+/* Convert n pixels of 32 bit 0x00RRGGBB to the screen format */
+typedef void (*pixel_convert_t)(uint8_t * dst, const uint32_t * src, uint32_t n);
+
+bool pixel_native(const pixel_format_t * format);
+pixel_convert_t pixel_converter(const pixel_format_t * format, const char ** name);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pm.h"
+#include "workers.h"
+
+/* Mean of 1/r over a unit square around its center, used as cell self potential */
+#define PM_SELF_POTENTIAL	3.5254943480781717
+
+typedef struct
+{
+	double re, im;
+}cplx_t;
+
+/*
+ * Mass grid is N x N, FFT grid is M x M with M = 2N. Zero padding turns
+ * the cyclic FFT convolution into the isolated (non periodic) one.
+ */
+static struct
+{
+	uint16_t n, m;
+	uint8_t workers;
+	cplx_t * rho; //mass, then potential, M x M
+	cplx_t * green; //FFT of 1/r kernel in cell units, M x M
+	cplx_t * twiddle; //M / 2
+	cplx_t * column; //M per worker
+	double * ax, * ay; //N x N
+
+	//current step
+	bodies_t * bodies;
+	const uint32_t * active; //bodies to interpolate, NULL = all
+	double h, ox, oy;
+	bool inverse;
+}pm;
+
+/* Functions */
+static bool pm_setup(uint16_t grid);
+static void fft(cplx_t * data, bool inverse);
+static void fft_rows(uint16_t rows, bool inverse);
+static void fft_columns(bool inverse);
+static void green_function(void);
+static void rows_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void columns_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void convolve_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void gradient_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void interpolate_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Particle-mesh gravity: deposit masses on the grid (CIC), get potential
+ * by FFT convolution with the 1/r kernel, interpolate forces back (CIC).
+ * Grid covers bounding box of live bodies, grid must be power of two.
+ * Only active bodies get new ax/ay (all when active is NULL).
+ * Returns false if the grid cannot be allocated.
+ */
+bool pm_gravity(bodies_t * bodies, uint16_t grid, const uint32_t * active, uint32_t active_s)
+{
+	double x_min = INFINITY, x_max = -INFINITY, y_min = INFINITY, y_max = -INFINITY;
+
+	if (active)
+		for (uint32_t k = 0; k != active_s; k++)
+			bodies->ax[active[k]] = bodies->ay[active[k]] = 0;
+	else
+	{
+		memset(bodies->ax, 0, sizeof(double) * bodies->size);
+		memset(bodies->ay, 0, sizeof(double) * bodies->size);
+	}
+
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		if (!bodies->alive[i])
+			continue;
+
+		if (bodies->x[i] < x_min) x_min = bodies->x[i];
+		if (bodies->x[i] > x_max) x_max = bodies->x[i];
+		if (bodies->y[i] < y_min) y_min = bodies->y[i];
+		if (bodies->y[i] > y_max) y_max = bodies->y[i];
+	}
+
+	if (x_min > x_max)
+		return true;
+
+	if (!pm_setup(grid))
+		return false;
+
+	const uint16_t n = pm.n, m = pm.m;
+
+	//one cell margin on each side so CIC never leaves the grid
+	pm.h = fmax(fmax(x_max - x_min, y_max - y_min), 1e-9) / (n - 3) * 1.0001;
+	pm.ox = (x_min + x_max) / 2 - pm.h * n / 2;
+	pm.oy = (y_min + y_max) / 2 - pm.h * n / 2;
+	pm.bodies = bodies;
+	pm.active = active;
+
+	memset(pm.rho, 0, sizeof(cplx_t) * m * m);
+
+	/* CIC mass assignment, serial to keep summation order fixed */
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		if (!bodies->alive[i])
+			continue;
+
+		double gx = (bodies->x[i] - pm.ox) / pm.h, gy = (bodies->y[i] - pm.oy) / pm.h;
+		uint16_t cx = gx, cy = gy;
+		double fx = gx - cx, fy = gy - cy, w = bodies->m[i];
+		cplx_t * cell = pm.rho + cy * m + cx;
+
+		cell[0].re += w * (1 - fx) * (1 - fy);
+		cell[1].re += w * fx * (1 - fy);
+		cell[m].re += w * (1 - fx) * fy;
+		cell[m + 1].re += w * fx * fy;
+	}
+
+	/* potential = rho (*) green, only first N rows of rho are not zero */
+	fft_rows(n, false);
+	fft_columns(false);
+	workers_run(convolve_job, NULL, m, 0);
+	fft_columns(true);
+	fft_rows(n + 1, true); //row N is read by the gradient of the top row
+
+	/* acceleration on the grid and back to bodies */
+	workers_run(gradient_job, NULL, n, 0);
+	workers_run(interpolate_job, NULL, active ? active_s : bodies->size, 1024);
+	return true;
+}
+
+/**
+ * Release grid memory
+ */
+void pm_free(void)
+{
+	free(pm.rho);
+	free(pm.green);
+	free(pm.twiddle);
+	free(pm.column);
+	free(pm.ax);
+	free(pm.ay);
+	memset(&pm, 0, sizeof(pm));
+}
+
+/**
+ * (Re)allocate grid and kernel if resolution changed, false if out of
+ * memory (nothing is kept then, next call tries again)
+ */
+static bool pm_setup(uint16_t grid)
+{
+	if (grid == pm.n)
+	{
+		if (pm.workers != workers_count())
+		{
+			cplx_t * column = realloc(pm.column, sizeof(cplx_t) * pm.m * workers_count());
+
+			if (!column)
+				return false;
+			pm.column = column;
+			pm.workers = workers_count();
+		}
+		return true;
+	}
+
+	if (grid < 8 || grid > 4096 || (grid & (grid - 1)))
+		return false;
+
+	pm_free();
+
+	pm.n = grid;
+	pm.m = grid * 2;
+	pm.workers = workers_count();
+
+	pm.rho = malloc(sizeof(cplx_t) * pm.m * pm.m);
+	pm.green = malloc(sizeof(cplx_t) * pm.m * pm.m);
+	pm.twiddle = malloc(sizeof(cplx_t) * pm.m / 2);
+	pm.column = malloc(sizeof(cplx_t) * pm.m * pm.workers);
+	pm.ax = malloc(sizeof(double) * pm.n * pm.n);
+	pm.ay = malloc(sizeof(double) * pm.n * pm.n);
+
+	if (!pm.rho || !pm.green || !pm.twiddle || !pm.column || !pm.ax || !pm.ay)
+	{
+		pm_free();
+		return false;
+	}
+
+	for (uint16_t k = 0; k != pm.m / 2; k++)
+	{
+		pm.twiddle[k].re = cos(-2 * M_PI * k / pm.m);
+		pm.twiddle[k].im = sin(-2 * M_PI * k / pm.m);
+	}
+
+	green_function();
+
+	return true;
+}
+
+/**
+ * FFT of potential kernel -1/d, d is distance in cells with wrap around
+ */
+static void green_function(void)
+{
+	const uint16_t m = pm.m;
+	cplx_t * rho = pm.rho;
+
+	for (uint16_t y = 0; y != m; y++)
+		for (uint16_t x = 0; x != m; x++)
+		{
+			double dx = x <= m / 2 ? x : m - x;
+			double dy = y <= m / 2 ? y : m - y;
+			double d = sqrt(dx * dx + dy * dy);
+
+			rho[y * m + x].re = d ? -1 / d : -PM_SELF_POTENTIAL;
+			rho[y * m + x].im = 0;
+		}
+
+	//transform in place using rho as work buffer
+	fft_rows(m, false);
+	fft_columns(false);
+	memcpy(pm.green, rho, sizeof(cplx_t) * m * m);
+}
+
+/**
+ * In place radix-2 FFT of M points, inverse is not normalized
+ */
+static void fft(cplx_t * data, bool inverse)
+{
+	const uint16_t m = pm.m;
+
+	for (uint16_t i = 1, j = 0; i != m; i++)
+	{
+		uint16_t bit = m >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j |= bit;
+
+		if (i < j)
+		{
+			cplx_t t = data[i];
+			data[i] = data[j];
+			data[j] = t;
+		}
+	}
+
+	for (uint16_t len = 2; len <= m; len <<= 1)
+	{
+		uint16_t step = m / len;
+
+		for (uint16_t i = 0; i != m; i += len)
+			for (uint16_t k = 0; k != len / 2; k++)
+			{
+				cplx_t w = pm.twiddle[k * step];
+				if (inverse) w.im = -w.im;
+
+				cplx_t * a = &data[i + k], * b = &data[i + k + len / 2];
+				cplx_t t = { b->re * w.re - b->im * w.im, b->re * w.im + b->im * w.re };
+
+				b->re = a->re - t.re;
+				b->im = a->im - t.im;
+				a->re += t.re;
+				a->im += t.im;
+			}
+	}
+}
+
+static void fft_rows(uint16_t rows, bool inverse)
+{
+	pm.inverse = inverse;
+	workers_run(rows_job, NULL, rows, 0);
+}
+
+static void fft_columns(bool inverse)
+{
+	pm.inverse = inverse;
+	workers_run(columns_job, NULL, pm.m, 0);
+}
+
+static void rows_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t y = begin; y != end; y++)
+		fft(pm.rho + y * pm.m, pm.inverse);
+}
+
+static void columns_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const uint16_t m = pm.m;
+	cplx_t * column = pm.column + worker * m;
+
+	for (uint32_t x = begin; x != end; x++)
+	{
+		for (uint16_t y = 0; y != m; y++)
+			column[y] = pm.rho[y * m + x];
+
+		fft(column, pm.inverse);
+
+		for (uint16_t y = 0; y != m; y++)
+			pm.rho[y * m + x] = column[y];
+	}
+}
+
+static void convolve_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t k = begin * pm.m; k != end * pm.m; k++)
+	{
+		cplx_t a = pm.rho[k], b = pm.green[k];
+		pm.rho[k].re = a.re * b.re - a.im * b.im;
+		pm.rho[k].im = a.re * b.im + a.im * b.re;
+	}
+}
+
+/**
+ * Acceleration on the grid, central difference of potential
+ */
+static void gradient_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const uint16_t n = pm.n, m = pm.m;
+	const double scale = -G / (pm.h * pm.h) / ((double)m * m) / 2;
+
+	for (uint32_t y = begin; y != end; y++)
+		for (uint16_t x = 0; x != n; x++)
+		{
+			const cplx_t * p = pm.rho + y * m + x;
+			double left = x ? p[-1].re : 0, down = y ? p[-m].re : 0;
+
+			pm.ax[y * n + x] = scale * (p[1].re - left);
+			pm.ay[y * n + x] = scale * (p[m].re - down);
+		}
+}
+
+/**
+ * CIC interpolation of grid acceleration back to bodies
+ */
+static void interpolate_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const uint16_t n = pm.n;
+	bodies_t * bodies = pm.bodies;
+
+	for (uint32_t b = begin; b != end; b++)
+	{
+		uint32_t i = pm.active ? pm.active[b] : b;
+
+		if (!bodies->alive[i])
+			continue;
+
+		double gx = (bodies->x[i] - pm.ox) / pm.h, gy = (bodies->y[i] - pm.oy) / pm.h;
+		uint16_t cx = gx, cy = gy;
+		double fx = gx - cx, fy = gy - cy;
+		uint32_t k = cy * n + cx;
+
+		bodies->ax[i] = pm.ax[k] * (1 - fx) * (1 - fy) + pm.ax[k + 1] * fx * (1 - fy) + \
+			pm.ax[k + n] * (1 - fx) * fy + pm.ax[k + n + 1] * fx * fy;
+		bodies->ay[i] = pm.ay[k] * (1 - fx) * (1 - fy) + pm.ay[k + 1] * fx * (1 - fy) + \
+			pm.ay[k + n] * (1 - fx) * fy + pm.ay[k + n + 1] * fx * fy;
+	}
+}
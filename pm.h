@@ -0,0 +1,10 @@
+#ifndef PM_H
+#define PM_H
+
+#include <stdint.h>
+#include "space.h"
+
+bool pm_gravity(bodies_t * bodies, uint16_t grid, const uint32_t * active, uint32_t active_s);
+void pm_free(void);
+
+#endif
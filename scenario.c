@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "scenario.h"
+
+#define SCENARIO_MAGIC		"PSBODIES"
+#define SCENARIO_CHUNK		65536 //bodies per read of radius and color
+#define SCENARIO_LINE		1024
+#define SCENARIO_RECORD		(5 * sizeof(double) + sizeof(uint16_t) + sizeof(uint32_t)) //bytes of one body
+
+/*
+ * Initial conditions from a file, binary if it starts with the magic,
+ * CSV otherwise.
+ *
+ * Binary, little-endian: magic, version u32, count u32, then arrays of
+ * count items: x, y, vx, vy, mass as double, radius u16, color u32
+ * (0x00RRGGBB). Arrays are read straight into the body store.
+ *
+ * CSV: one body per line, x,y,vx,vy,mass[,radius[,color[,name]]], color
+ * in hex. Empty lines, lines starting with # and a header line are
+ * skipped. Radius defaults to 1, color to white.
+ *
+ * Both formats need finite values and mass above 0, radius 0 is 1.
+ */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+}scenario_header_t;
+
+/* Functions */
+static const char * load_binary(FILE * in, bodies_t * bodies);
+static const char * load_csv(FILE * in, bodies_t * bodies);
+static bool data_line(const char * line);
+
+static char error[64];
+
+/**
+ * Bodies from file, the store is allocated for them. Returns "OK" or error.
+ */
+const char * scenario_load(const char * file, bodies_t * bodies)
+{
+	char magic[8];
+	FILE * in = fopen(file, "rb");
+
+	if (!in)
+		return "Fail to open scenario!";
+
+	const bool binary = fread(magic, sizeof(magic), 1, in) == 1 && !memcmp(magic, SCENARIO_MAGIC, sizeof(magic));
+	rewind(in);
+
+	const char * result = binary ? load_binary(in, bodies) : load_csv(in, bodies);
+	fclose(in);
+
+	if (!strcmp(result, "OK") && !bodies->size)
+	{
+		bodies_free(bodies);
+		return "No bodies in scenario!";
+	}
+
+	return result;
+}
+
+static const char * load_binary(FILE * in, bodies_t * bodies)
+{
+	scenario_header_t header;
+	double * field[5];
+	struct stat st;
+
+	if (*(const uint8_t *)&(uint32_t){ 1 } != 1)
+		return "Binary scenario needs a little-endian machine!";
+
+	if (fread(&header, sizeof(header), 1, in) != 1)
+		return "Scenario is truncated!";
+	if (header.version != SCENARIO_VERSION)
+		return "Unsupported scenario version!";
+
+	//before the count sizes the arena
+	if (fstat(fileno(in), &st) || (uint64_t)st.st_size < sizeof(header) + (uint64_t)header.count * SCENARIO_RECORD)
+		return "Scenario is truncated!";
+
+	uint16_t * r = malloc(sizeof(uint16_t) * SCENARIO_CHUNK);
+	uint32_t * color = malloc(sizeof(uint32_t) * SCENARIO_CHUNK);
+
+	if (!r || !color || !bodies_alloc(bodies, header.count))
+	{
+		free(r);
+		free(color);
+		return "Fail to allocate bodies!";
+	}
+
+	field[0] = bodies->x;
+	field[1] = bodies->y;
+	field[2] = bodies->vx;
+	field[3] = bodies->vy;
+	field[4] = bodies->m;
+
+	bool ok = true;
+	for (uint8_t f = 0; f != 5 && ok; f++)
+		ok = fread(field[f], sizeof(double), header.count, in) == header.count;
+
+	//radius and color go to the info table, through a small buffer
+	for (uint32_t i = 0; i < header.count && ok; i += SCENARIO_CHUNK)
+	{
+		const uint32_t n = header.count - i < SCENARIO_CHUNK ? header.count - i : SCENARIO_CHUNK;
+
+		ok = fread(r, sizeof(uint16_t), n, in) == n;
+		for (uint32_t k = 0; k != n && ok; k++)
+			bodies->info[i + k].r = r[k] ? r[k] : 1; //as in CSV
+	}
+	for (uint32_t i = 0; i < header.count && ok; i += SCENARIO_CHUNK)
+	{
+		const uint32_t n = header.count - i < SCENARIO_CHUNK ? header.count - i : SCENARIO_CHUNK;
+
+		ok = fread(color, sizeof(uint32_t), n, in) == n;
+		for (uint32_t k = 0; k != n && ok; k++)
+			bodies->info[i + k].color = color[k];
+	}
+
+	free(r);
+	free(color);
+
+	if (!ok)
+	{
+		bodies_free(bodies);
+		return "Scenario is truncated!";
+	}
+
+	//same rules as CSV: finite values, mass above 0
+	for (uint32_t i = 0; i != header.count; i++)
+		if (!isfinite(bodies->x[i]) || !isfinite(bodies->y[i]) || !isfinite(bodies->vx[i]) || !isfinite(bodies->vy[i]) || \
+			!isfinite(bodies->m[i]) || bodies->m[i] <= 0)
+		{
+			bodies_free(bodies);
+			snprintf(error, sizeof(error), "Bad body %u!", i);
+			return error;
+		}
+
+	memcpy(bodies->x0, bodies->x, sizeof(double) * header.count);
+	memcpy(bodies->y0, bodies->y, sizeof(double) * header.count);
+	memset(bodies->alive, true, header.count);
+	for (uint32_t i = 0; i != header.count; i++)
+		bodies->info[i].isMoving = true;
+
+	return "OK";
+}
+
+/**
+ * Two passes: count bodies to allocate the store once, then parse
+ */
+static const char * load_csv(FILE * in, bodies_t * bodies)
+{
+	char line[SCENARIO_LINE];
+	uint32_t count = 0, lines = 0, i = 0;
+
+	while (fgets(line, sizeof(line), in))
+	{
+		lines++;
+		if (!strchr(line, '\n') && !feof(in)) //would be split into two
+		{
+			snprintf(error, sizeof(error), "Line %u is too long!", lines);
+			return error;
+		}
+		count += data_line(line);
+	}
+	lines = 0;
+
+	if (!bodies_alloc(bodies, count))
+		return "Fail to allocate bodies!";
+
+	rewind(in);
+	while (i != count && fgets(line, sizeof(line), in))
+	{
+		object_t object = { .color = 0xFFFFFF, .r = 1 };
+		double v[5];
+		char * p = line, * end;
+
+		lines++;
+		if (!data_line(line))
+			continue;
+
+		for (uint8_t f = 0; f != 5; f++)
+		{
+			v[f] = strtod(p, &end);
+			if (end == p || (*end != ',' && f != 4) || !isfinite(v[f]) || (f == 4 && v[f] <= 0))
+			{
+				bodies_free(bodies);
+				snprintf(error, sizeof(error), "Bad body at line %u!", lines);
+				return error;
+			}
+			p = *end == ',' ? end + 1 : end;
+		}
+
+		object.x = v[0];
+		object.y = v[1];
+		object.vx = v[2];
+		object.vy = v[3];
+		object.weight = v[4];
+
+		if (*end == ',')
+		{
+			const unsigned long r = strtoul(p, &end, 10);
+
+			object.r = r > UINT16_MAX ? UINT16_MAX : r ? r : 1;
+			if (*end == ',')
+			{
+				object.color = strtoul(p = end + 1, &end, 16) & 0xFFFFFF;
+				if (*end == ',')
+				{
+					p = end + 1;
+					p[strcspn(p, "\r\n")] = 0;
+					for (char * c = p; *c; c++) //fonts only have ASCII glyphs
+						if ((uint8_t)*c < ' ' || (uint8_t)*c > '~')
+							*c = '?';
+					object.name = p;
+				}
+			}
+		}
+
+		bodies_set(bodies, i++, &object);
+	}
+
+	return "OK";
+}
+
+/**
+ * Line with a body: not empty, not a comment, not a header
+ */
+static bool data_line(const char * line)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	return *line == '-' || *line == '+' || *line == '.' || isdigit((unsigned char)*line);
+}
@@ -0,0 +1,11 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <stdint.h>
+#include "bodies.h"
+
+#define SCENARIO_VERSION	1
+
+const char * scenario_load(const char * file, bodies_t * bodies);
+
+#endif
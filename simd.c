@@ -0,0 +1,582 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "simd.h"
+#include "workers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__aarch64__) || defined(__arm__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define SIMD_NEON
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#define NEON_TARGET __attribute__((target("fpu=neon")))
+#else
+#define NEON_TARGET
+#endif
+#endif
+
+#define SIMD_WIDTH		8 //widest vector, arrays are padded to it
+#define SIMD_FAR		1e6f //padding bodies sit far away with zero mass
+#define SIMD_SLICES		16 //fixed split of rows, results do not depend on thread count
+
+/*
+ * Single precision direct summation, every pair is computed once and
+ * applied to both bodies (Newton's third law). 1/r is rsqrt estimate plus
+ * one Newton-Raphson step, relative error of a pair is below 1e-6, sum
+ * over N bodies adds about 1e-7 * sqrt(N). Coordinates are taken around
+ * the mass center to keep float precision.
+ *
+ * Row i goes to slice i % SIMD_SLICES, each slice has own accumulators
+ * which are summed in slice order at the end.
+ *
+ * When only some bodies are active the pair trick does not pay off, each
+ * active body sums over all bodies in its own row kernel instead.
+ */
+static struct
+{
+	float * x, * y, * m;
+	float * ax, * ay; //SIMD_SLICES x padded
+	uint32_t * index; //position in body store
+	uint32_t size, padded, capacity;
+	double cx, cy; //mass center, origin of packed coordinates
+	float g;
+}bodies;
+
+static bodies_t * store;
+static const uint32_t * targets;
+static void (*kernel)(uint32_t slice);
+static void (*row)(float x, float y, float * ax, float * ay);
+static const char * kernel_name;
+
+/* Functions */
+static void select_kernel(void);
+static bool pack_bodies(bodies_t * store);
+static void kernel_scalar(uint32_t slice);
+static void row_scalar(float x, float y, float * ax, float * ay);
+static inline void pair(uint32_t i, uint32_t j, float * axi, float * ayi, float * ax, float * ay);
+static void slices_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void reduce_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void rows_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Name of kernel selected for this CPU
+ */
+const char * simd_kernel(void)
+{
+	select_kernel();
+	return kernel_name;
+}
+
+/**
+ * Drop-in replacement of gravity_object_to_object(), body store in and out,
+ * new ax/ay for active bodies (all when active is NULL).
+ * Returns false if out of memory.
+ */
+bool simd_gravity(bodies_t * _bodies, const uint32_t * active, uint32_t active_s)
+{
+	store = _bodies;
+	targets = active;
+
+	select_kernel();
+	if (!pack_bodies(store))
+		return false;
+
+	if (active)
+		for (uint32_t k = 0; k != active_s; k++)
+			store->ax[active[k]] = store->ay[active[k]] = 0;
+	else
+	{
+		memset(store->ax, 0, sizeof(double) * store->size);
+		memset(store->ay, 0, sizeof(double) * store->size);
+	}
+
+	if (bodies.size < 2)
+		return true;
+
+	if (active)
+	{
+		workers_run(rows_job, NULL, active_s, 64);
+		return true;
+	}
+
+	workers_run(slices_job, NULL, SIMD_SLICES, 1);
+	workers_run(reduce_job, NULL, bodies.size, 1024);
+	return true;
+}
+
+/**
+ * Release kernel memory
+ */
+void simd_free(void)
+{
+	free(bodies.x);
+	free(bodies.y);
+	free(bodies.m);
+	free(bodies.ax);
+	free(bodies.ay);
+	free(bodies.index);
+	memset(&bodies, 0, sizeof(bodies));
+}
+
+static bool pack_bodies(bodies_t * store)
+{
+	uint32_t padded = (store->size + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+	if (padded > bodies.capacity)
+	{
+		simd_free();
+		bodies.capacity = padded;
+		bodies.x = aligned_alloc(32, sizeof(float) * padded);
+		bodies.y = aligned_alloc(32, sizeof(float) * padded);
+		bodies.m = aligned_alloc(32, sizeof(float) * padded);
+		bodies.ax = aligned_alloc(32, sizeof(float) * padded * SIMD_SLICES);
+		bodies.ay = aligned_alloc(32, sizeof(float) * padded * SIMD_SLICES);
+		bodies.index = malloc(sizeof(uint32_t) * padded);
+
+		if (!bodies.x || !bodies.y || !bodies.m || !bodies.ax || !bodies.ay || !bodies.index)
+		{
+			simd_free();
+			return false;
+		}
+	}
+
+	double cx = 0, cy = 0, mass = 0;
+
+	for (uint32_t i = 0; i != store->size; i++)
+		if (store->alive[i])
+		{
+			cx += store->x[i] * store->m[i];
+			cy += store->y[i] * store->m[i];
+			mass += store->m[i];
+		}
+
+	if (mass)
+	{
+		cx /= mass;
+		cy /= mass;
+	}
+
+	bodies.cx = cx;
+	bodies.cy = cy;
+
+	bodies.size = 0;
+	for (uint32_t i = 0; i != store->size; i++)
+	{
+		if (!store->alive[i])
+			continue;
+
+		bodies.x[bodies.size] = store->x[i] - cx;
+		bodies.y[bodies.size] = store->y[i] - cy;
+		bodies.m[bodies.size] = store->m[i];
+		bodies.index[bodies.size] = i;
+		bodies.size++;
+	}
+
+	bodies.padded = (bodies.size + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+	for (uint32_t b = bodies.size; b != bodies.padded; b++)
+	{
+		bodies.x[b] = SIMD_FAR;
+		bodies.y[b] = SIMD_FAR;
+		bodies.m[b] = 0;
+	}
+
+	if (!targets)
+	{
+		memset(bodies.ax, 0, sizeof(float) * bodies.padded * SIMD_SLICES);
+		memset(bodies.ay, 0, sizeof(float) * bodies.padded * SIMD_SLICES);
+	}
+	bodies.g = G;
+	return true;
+}
+
+/**
+ * One pair in scalar code, used for the unaligned head of each row
+ */
+static inline void pair(uint32_t i, uint32_t j, float * axi, float * ayi, float * ax, float * ay)
+{
+	float dx = bodies.x[i] - bodies.x[j];
+	float dy = bodies.y[i] - bodies.y[j];
+	float r2 = dx * dx + dy * dy;
+
+	if (r2 == 0) return; //coincident bodies, merged by impact processing
+
+	float inv = 1 / sqrtf(r2);
+	float s = bodies.g * inv * inv * inv;
+
+	*axi -= bodies.m[j] * s * dx;
+	*ayi -= bodies.m[j] * s * dy;
+	ax[j] += bodies.m[i] * s * dx;
+	ay[j] += bodies.m[i] * s * dy;
+}
+
+static void kernel_scalar(uint32_t slice)
+{
+	float * ax = bodies.ax + slice * bodies.padded, * ay = bodies.ay + slice * bodies.padded;
+	for (uint32_t i = slice; i < bodies.size; i += SIMD_SLICES)
+	{
+		float axi = 0, ayi = 0;
+
+		for (uint32_t j = i + 1; j != bodies.size; j++)
+			pair(i, j, &axi, &ayi, ax, ay);
+
+		ax[i] += axi;
+		ay[i] += ayi;
+	}
+}
+
+/**
+ * Acceleration at (x, y) from all packed bodies, a body at the same
+ * point (the body itself) is skipped
+ */
+static void row_scalar(float x, float y, float * ax, float * ay)
+{
+	float sx = 0, sy = 0;
+
+	for (uint32_t j = 0; j != bodies.size; j++)
+	{
+		float dx = x - bodies.x[j];
+		float dy = y - bodies.y[j];
+		float r2 = dx * dx + dy * dy;
+
+		if (r2 == 0) continue;
+
+		float inv = 1 / sqrtf(r2);
+		float s = bodies.g * bodies.m[j] * inv * inv * inv;
+
+		sx -= s * dx;
+		sy -= s * dy;
+	}
+
+	*ax = sx;
+	*ay = sy;
+}
+
+#ifdef SIMD_X86
+__attribute__((target("sse2")))
+static void kernel_sse(uint32_t slice)
+{
+	float * ax = bodies.ax + slice * bodies.padded, * ay = bodies.ay + slice * bodies.padded;
+	const __m128 half = _mm_set1_ps(0.5f), three_half = _mm_set1_ps(1.5f), zero = _mm_setzero_ps();
+	const __m128 g = _mm_set1_ps(bodies.g);
+
+	for (uint32_t i = slice; i < bodies.size; i += SIMD_SLICES)
+	{
+		float axi = 0, ayi = 0;
+		uint32_t j = i + 1;
+
+		for (; j != bodies.size && (j & 3); j++)
+			pair(i, j, &axi, &ayi, ax, ay);
+
+		__m128 xi = _mm_set1_ps(bodies.x[i]), yi = _mm_set1_ps(bodies.y[i]), mi = _mm_set1_ps(bodies.m[i]);
+		__m128 vaxi = zero, vayi = zero;
+
+		for (; j < bodies.size; j += 4)
+		{
+			__m128 dx = _mm_sub_ps(xi, _mm_load_ps(bodies.x + j));
+			__m128 dy = _mm_sub_ps(yi, _mm_load_ps(bodies.y + j));
+			__m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			__m128 inv = _mm_rsqrt_ps(r2);
+
+			inv = _mm_mul_ps(inv, _mm_sub_ps(three_half, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+			inv = _mm_and_ps(inv, _mm_cmpgt_ps(r2, zero));
+
+			__m128 s = _mm_mul_ps(g, _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+			__m128 mj = _mm_mul_ps(_mm_load_ps(bodies.m + j), s);
+			__m128 mis = _mm_mul_ps(mi, s);
+
+			vaxi = _mm_sub_ps(vaxi, _mm_mul_ps(mj, dx));
+			vayi = _mm_sub_ps(vayi, _mm_mul_ps(mj, dy));
+			_mm_store_ps(ax + j, _mm_add_ps(_mm_load_ps(ax + j), _mm_mul_ps(mis, dx)));
+			_mm_store_ps(ay + j, _mm_add_ps(_mm_load_ps(ay + j), _mm_mul_ps(mis, dy)));
+		}
+
+		float sum[4];
+		_mm_storeu_ps(sum, vaxi);
+		axi += sum[0] + sum[1] + sum[2] + sum[3];
+		_mm_storeu_ps(sum, vayi);
+		ayi += sum[0] + sum[1] + sum[2] + sum[3];
+
+		ax[i] += axi;
+		ay[i] += ayi;
+	}
+}
+
+__attribute__((target("sse2")))
+static void row_sse(float x, float y, float * ax, float * ay)
+{
+	const __m128 half = _mm_set1_ps(0.5f), three_half = _mm_set1_ps(1.5f), zero = _mm_setzero_ps();
+	const __m128 g = _mm_set1_ps(bodies.g);
+	__m128 xi = _mm_set1_ps(x), yi = _mm_set1_ps(y);
+	__m128 vax = zero, vay = zero;
+
+	for (uint32_t j = 0; j < bodies.padded; j += 4)
+	{
+		__m128 dx = _mm_sub_ps(xi, _mm_load_ps(bodies.x + j));
+		__m128 dy = _mm_sub_ps(yi, _mm_load_ps(bodies.y + j));
+		__m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		__m128 inv = _mm_rsqrt_ps(r2);
+
+		inv = _mm_mul_ps(inv, _mm_sub_ps(three_half, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+		inv = _mm_and_ps(inv, _mm_cmpgt_ps(r2, zero));
+
+		__m128 s = _mm_mul_ps(g, _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+		__m128 mj = _mm_mul_ps(_mm_load_ps(bodies.m + j), s);
+
+		vax = _mm_sub_ps(vax, _mm_mul_ps(mj, dx));
+		vay = _mm_sub_ps(vay, _mm_mul_ps(mj, dy));
+	}
+
+	float sum[4];
+	_mm_storeu_ps(sum, vax);
+	*ax = sum[0] + sum[1] + sum[2] + sum[3];
+	_mm_storeu_ps(sum, vay);
+	*ay = sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(uint32_t slice)
+{
+	float * ax = bodies.ax + slice * bodies.padded, * ay = bodies.ay + slice * bodies.padded;
+	const __m256 half = _mm256_set1_ps(0.5f), three_half = _mm256_set1_ps(1.5f), zero = _mm256_setzero_ps();
+	const __m256 g = _mm256_set1_ps(bodies.g);
+
+	for (uint32_t i = slice; i < bodies.size; i += SIMD_SLICES)
+	{
+		float axi = 0, ayi = 0;
+		uint32_t j = i + 1;
+
+		for (; j != bodies.size && (j & 7); j++)
+			pair(i, j, &axi, &ayi, ax, ay);
+
+		__m256 xi = _mm256_set1_ps(bodies.x[i]), yi = _mm256_set1_ps(bodies.y[i]), mi = _mm256_set1_ps(bodies.m[i]);
+		__m256 vaxi = zero, vayi = zero;
+
+		for (; j < bodies.size; j += 8)
+		{
+			__m256 dx = _mm256_sub_ps(xi, _mm256_load_ps(bodies.x + j));
+			__m256 dy = _mm256_sub_ps(yi, _mm256_load_ps(bodies.y + j));
+			__m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+			__m256 inv = _mm256_rsqrt_ps(r2);
+
+			inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), three_half));
+			inv = _mm256_and_ps(inv, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+
+			__m256 s = _mm256_mul_ps(g, _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+			__m256 mj = _mm256_mul_ps(_mm256_load_ps(bodies.m + j), s);
+			__m256 mis = _mm256_mul_ps(mi, s);
+
+			vaxi = _mm256_fnmadd_ps(mj, dx, vaxi);
+			vayi = _mm256_fnmadd_ps(mj, dy, vayi);
+			_mm256_store_ps(ax + j, _mm256_fmadd_ps(mis, dx, _mm256_load_ps(ax + j)));
+			_mm256_store_ps(ay + j, _mm256_fmadd_ps(mis, dy, _mm256_load_ps(ay + j)));
+		}
+
+		float sum[8];
+		_mm256_storeu_ps(sum, vaxi);
+		axi += sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+		_mm256_storeu_ps(sum, vayi);
+		ayi += sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+
+		ax[i] += axi;
+		ay[i] += ayi;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void row_avx2(float x, float y, float * ax, float * ay)
+{
+	const __m256 half = _mm256_set1_ps(0.5f), three_half = _mm256_set1_ps(1.5f), zero = _mm256_setzero_ps();
+	const __m256 g = _mm256_set1_ps(bodies.g);
+	__m256 xi = _mm256_set1_ps(x), yi = _mm256_set1_ps(y);
+	__m256 vax = zero, vay = zero;
+
+	for (uint32_t j = 0; j < bodies.padded; j += 8)
+	{
+		__m256 dx = _mm256_sub_ps(xi, _mm256_load_ps(bodies.x + j));
+		__m256 dy = _mm256_sub_ps(yi, _mm256_load_ps(bodies.y + j));
+		__m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+		__m256 inv = _mm256_rsqrt_ps(r2);
+
+		inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), three_half));
+		inv = _mm256_and_ps(inv, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+
+		__m256 s = _mm256_mul_ps(g, _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+		__m256 mj = _mm256_mul_ps(_mm256_load_ps(bodies.m + j), s);
+
+		vax = _mm256_fnmadd_ps(mj, dx, vax);
+		vay = _mm256_fnmadd_ps(mj, dy, vay);
+	}
+
+	float sum[8];
+	_mm256_storeu_ps(sum, vax);
+	*ax = sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+	_mm256_storeu_ps(sum, vay);
+	*ay = sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+}
+#endif
+
+#ifdef SIMD_NEON
+NEON_TARGET
+static void kernel_neon(uint32_t slice)
+{
+	float * ax = bodies.ax + slice * bodies.padded, * ay = bodies.ay + slice * bodies.padded;
+	const float32x4_t zero = vdupq_n_f32(0), g = vdupq_n_f32(bodies.g);
+
+	for (uint32_t i = slice; i < bodies.size; i += SIMD_SLICES)
+	{
+		float axi = 0, ayi = 0;
+		uint32_t j = i + 1;
+
+		for (; j != bodies.size && (j & 3); j++)
+			pair(i, j, &axi, &ayi, ax, ay);
+
+		float32x4_t xi = vdupq_n_f32(bodies.x[i]), yi = vdupq_n_f32(bodies.y[i]), mi = vdupq_n_f32(bodies.m[i]);
+		float32x4_t vaxi = zero, vayi = zero;
+
+		for (; j < bodies.size; j += 4)
+		{
+			float32x4_t dx = vsubq_f32(xi, vld1q_f32(bodies.x + j));
+			float32x4_t dy = vsubq_f32(yi, vld1q_f32(bodies.y + j));
+			float32x4_t r2 = vmlaq_f32(vmulq_f32(dy, dy), dx, dx);
+			float32x4_t inv = vrsqrteq_f32(r2);
+
+			inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(r2, inv), inv));
+			inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(r2, inv), inv)); //estimate is only 8 bits
+			inv = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(inv), vcgtq_f32(r2, zero)));
+
+			float32x4_t s = vmulq_f32(g, vmulq_f32(inv, vmulq_f32(inv, inv)));
+			float32x4_t mj = vmulq_f32(vld1q_f32(bodies.m + j), s);
+			float32x4_t mis = vmulq_f32(mi, s);
+
+			vaxi = vmlsq_f32(vaxi, mj, dx);
+			vayi = vmlsq_f32(vayi, mj, dy);
+			vst1q_f32(ax + j, vmlaq_f32(vld1q_f32(ax + j), mis, dx));
+			vst1q_f32(ay + j, vmlaq_f32(vld1q_f32(ay + j), mis, dy));
+		}
+
+		float sum[4];
+		vst1q_f32(sum, vaxi);
+		axi += sum[0] + sum[1] + sum[2] + sum[3];
+		vst1q_f32(sum, vayi);
+		ayi += sum[0] + sum[1] + sum[2] + sum[3];
+
+		ax[i] += axi;
+		ay[i] += ayi;
+	}
+}
+
+NEON_TARGET
+static void row_neon(float x, float y, float * ax, float * ay)
+{
+	const float32x4_t zero = vdupq_n_f32(0), g = vdupq_n_f32(bodies.g);
+	float32x4_t xi = vdupq_n_f32(x), yi = vdupq_n_f32(y);
+	float32x4_t vax = zero, vay = zero;
+
+	for (uint32_t j = 0; j < bodies.padded; j += 4)
+	{
+		float32x4_t dx = vsubq_f32(xi, vld1q_f32(bodies.x + j));
+		float32x4_t dy = vsubq_f32(yi, vld1q_f32(bodies.y + j));
+		float32x4_t r2 = vmlaq_f32(vmulq_f32(dy, dy), dx, dx);
+		float32x4_t inv = vrsqrteq_f32(r2);
+
+		inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(r2, inv), inv));
+		inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(r2, inv), inv));
+		inv = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(inv), vcgtq_f32(r2, zero)));
+
+		float32x4_t mj = vmulq_f32(vld1q_f32(bodies.m + j), vmulq_f32(g, vmulq_f32(inv, vmulq_f32(inv, inv))));
+
+		vax = vmlsq_f32(vax, mj, dx);
+		vay = vmlsq_f32(vay, mj, dy);
+	}
+
+	float sum[4];
+	vst1q_f32(sum, vax);
+	*ax = sum[0] + sum[1] + sum[2] + sum[3];
+	vst1q_f32(sum, vay);
+	*ay = sum[0] + sum[1] + sum[2] + sum[3];
+}
+#endif
+
+static void slices_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t slice = begin; slice != end; slice++)
+		kernel(slice);
+}
+
+/**
+ * Sum slice accumulators in fixed order
+ */
+static void reduce_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t b = begin; b != end; b++)
+	{
+		float ax = 0, ay = 0;
+
+		for (uint32_t slice = 0; slice != SIMD_SLICES; slice++)
+		{
+			ax += bodies.ax[slice * bodies.padded + b];
+			ay += bodies.ay[slice * bodies.padded + b];
+		}
+
+		store->ax[bodies.index[b]] = ax;
+		store->ay[bodies.index[b]] = ay;
+	}
+}
+
+static void rows_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t k = begin; k != end; k++)
+	{
+		uint32_t i = targets[k];
+		float ax, ay;
+
+		row(store->x[i] - bodies.cx, store->y[i] - bodies.cy, &ax, &ay);
+		store->ax[i] = ax;
+		store->ay[i] = ay;
+	}
+}
+
+/**
+ * Pick the widest kernel this CPU can run, once
+ */
+static void select_kernel(void)
+{
+	if (kernel)
+		return;
+
+	kernel = kernel_scalar;
+	row = row_scalar;
+	kernel_name = "scalar";
+
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		kernel = kernel_sse;
+		row = row_sse;
+		kernel_name = "sse";
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		kernel = kernel_avx2;
+		row = row_avx2;
+		kernel_name = "avx2";
+	}
+#endif
+
+#ifdef SIMD_NEON
+#if defined(__arm__)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+	{
+		kernel = kernel_neon;
+		row = row_neon;
+		kernel_name = "neon";
+	}
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include "space.h"
+
+const char * simd_kernel(void);
+bool simd_gravity(bodies_t * bodies, const uint32_t * active, uint32_t active_s);
+void simd_free(void);
+
+#endif
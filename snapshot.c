@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "workers.h"
+
+#define SNAPSHOT_FRESH		4 //middle slot is published and not taken yet
+
+/*
+ * Lock-free triple buffer between the simulation (writer) and the
+ * renderer (reader). The writer fills its back slot and swaps it with
+ * the middle one, the reader swaps its front slot with the middle one
+ * when that is fresh. Each side always owns one slot, so neither waits
+ * for the other, and the reader gets the latest published state, never
+ * a half written one. Bodies are stored by id, so reordering of the
+ * store does not move them between snapshots.
+ */
+static struct
+{
+	snapshot_t slot[3];
+	uint8_t back, middle, front; //middle is shared, index | SNAPSHOT_FRESH
+	bool taken; //reader got a snapshot
+	char (* name)[BODY_NAME_SIZE];
+
+	//current capture
+	const bodies_t * bodies;
+	snapshot_t * snapshot;
+}triple;
+
+/* Functions */
+static void capture_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+static size_t align(size_t size)
+{
+	return (size + BODIES_ALIGN - 1) / BODIES_ALIGN * BODIES_ALIGN;
+}
+
+/**
+ * Three snapshots for all ids of the store. Names do not change, they
+ * are copied once.
+ */
+bool snapshot_init(const bodies_t * bodies)
+{
+	const uint32_t n = bodies->capacity;
+	const size_t hot = align(sizeof(double) * n);
+	const size_t total = 3 * hot + align(sizeof(uint32_t) * n) + align(sizeof(uint16_t) * n) + align(n);
+
+	snapshot_free();
+
+	triple.name = malloc(BODY_NAME_SIZE * (n ? n : 1));
+	if (!triple.name)
+		return false;
+
+	for (uint32_t id = 0; id != n; id++)
+		if (bodies->slot[id] != BODIES_NONE)
+			memcpy(triple.name[id], bodies->info[bodies->slot[id]].name, BODY_NAME_SIZE);
+		else
+			triple.name[id][0] = 0;
+
+	for (uint8_t s = 0; s != 3; s++)
+	{
+		snapshot_t * snapshot = &triple.slot[s];
+		uint8_t * arena = aligned_alloc(BODIES_ALIGN, total ? total : BODIES_ALIGN);
+
+		if (!arena)
+		{
+			snapshot_free();
+			return false;
+		}
+
+		memset(arena, 0, total);
+		snapshot->arena = arena;
+		snapshot->x = (double *)arena; arena += hot;
+		snapshot->y = (double *)arena; arena += hot;
+		snapshot->m = (double *)arena; arena += hot;
+		snapshot->color = (uint32_t *)arena; arena += align(sizeof(uint32_t) * n);
+		snapshot->r = (uint16_t *)arena; arena += align(sizeof(uint16_t) * n);
+		snapshot->alive = arena;
+		snapshot->name = (const char (*)[BODY_NAME_SIZE])triple.name;
+	}
+
+	triple.back = 0;
+	triple.middle = 1;
+	triple.front = 2;
+	triple.taken = false;
+
+	return true;
+}
+
+/**
+ * Snapshot the writer fills, it is not seen by the reader until published
+ */
+snapshot_t * snapshot_back(void)
+{
+	return &triple.slot[triple.back];
+}
+
+/**
+ * Copy bodies into the snapshot, on the workers
+ */
+void snapshot_capture(snapshot_t * snapshot, const bodies_t * bodies)
+{
+	triple.bodies = bodies;
+	triple.snapshot = snapshot;
+	snapshot->size = bodies->capacity;
+	workers_run(capture_job, 0, snapshot->size, 0);
+}
+
+/**
+ * Make the back snapshot the latest one, writer continues with another
+ */
+void snapshot_publish(void)
+{
+	triple.back = __atomic_exchange_n(&triple.middle, triple.back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL) & ~SNAPSHOT_FRESH;
+}
+
+/**
+ * Latest published snapshot, fresh tells it is new since the last call.
+ * NULL before the first publish. It stays valid until the next call.
+ */
+const snapshot_t * snapshot_take(bool * fresh)
+{
+	*fresh = __atomic_load_n(&triple.middle, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH;
+
+	if (*fresh)
+	{
+		triple.front = __atomic_exchange_n(&triple.middle, triple.front, __ATOMIC_ACQ_REL) & ~SNAPSHOT_FRESH;
+		triple.taken = true;
+	}
+
+	return triple.taken ? &triple.slot[triple.front] : 0;
+}
+
+void snapshot_free(void)
+{
+	for (uint8_t s = 0; s != 3; s++)
+		free(triple.slot[s].arena);
+	free(triple.name);
+	memset(&triple, 0, sizeof(triple));
+}
+
+static void capture_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const bodies_t * bodies = triple.bodies;
+	snapshot_t * snapshot = triple.snapshot;
+
+	for (uint32_t id = begin; id != end; id++)
+	{
+		const uint32_t i = bodies->slot[id];
+
+		if (i == BODIES_NONE)
+		{
+			snapshot->alive[id] = 0;
+			continue;
+		}
+
+		snapshot->x[id] = bodies->x[i];
+		snapshot->y[id] = bodies->y[i];
+		snapshot->m[id] = bodies->m[i];
+		snapshot->color[id] = bodies->info[i].color;
+		snapshot->r[id] = bodies->info[i].r;
+		snapshot->alive[id] = bodies->alive[i];
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+/* State after a simulation step as the renderer sees it, bodies by id */
+typedef struct
+{
+	uint64_t step; //steps done
+	uint64_t time; //ns, when the step was due
+	double mass_x, mass_y; //mass center
+	uint32_t size; //ids
+	double * x, * y, * m;
+	uint32_t * color;
+	uint16_t * r; //radius
+	uint8_t * alive; //0 also for bodies dropped from the store
+	const char (* name)[BODY_NAME_SIZE]; //same in all snapshots
+
+	void * arena;
+}snapshot_t;
+
+bool snapshot_init(const bodies_t * bodies);
+snapshot_t * snapshot_back(void);
+void snapshot_capture(snapshot_t * snapshot, const bodies_t * bodies);
+void snapshot_publish(void);
+const snapshot_t * snapshot_take(bool * fresh);
+void snapshot_free(void);
+
+#endif
@@ -4,50 +4,171 @@
 #include <stdbool.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
 #include "framebuffer.h"
 #include "font8x8_basic.h"
+#include "space.h"
+#include "tree.h"
+#include "pm.h"
+#include "simd.h"
+#include "workers.h"
+#include "morton.h"
+#include "broadphase.h"
+#include "bench.h"
+#include "sprite.h"
+#include "splat.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "scenario.h"
+#include "generate.h"
+#include "impacts.h"
 
-const uint16_t radius[] = { 2, 5 }; // min, max
-const uint16_t speed_x10[] = { 1, 10 }; // min, max
-const uint16_t weight[] = { 10, 50 }; // min, max
-const uint32_t colors[] = { WHITE32, RED32, GREEN32, BLUE32, YELLOW32, CYAN32, MAGENTA32, SILVER32, GRAY32, MAROON32, OLIVE32 };
-const char * names[] = { "SUN", "MERCURY", "VENUS", "EARTH", "MARS", "JUPITER", "SATURN", "URANUS", "NEPTUNE" };
 const double G = 1; //gravity constant
 const uint8_t GAP = 5;
+const uint8_t CROSS_SIZE = 10; //mass center marker
+
+space_options_t space_options = { .gravity = GRAVITY_EXACT, .theta = 0.5, .pm_grid = 256, .tolerance = 0, .reorder = 0, .dt = 1, \
+	.levels = 0, .eta = 0.2, .seed = 1, .steps = 0, .bench = NULL, .overlay = false, \
+	.zoom = 1, .splat = 1, .rate = 100 };
+const char * gravity_names[] = { "exact", "tree", "pm", "simd" };
+const char * model_names[] = { "uniform", "plummer", "disk", "merger" };
 struct
 {
 	double X, Y;
 }screen_center;
 
+/* Camera: screen position of a body is x0 + x * zoom, follows screen_center */
+static struct
+{
+	double x0, y0, zoom;
+}camera;
+
 uint16_t lcd_width, lcd_heigh; //lcd properties
 uint32_t lcd_backColor;
 Font_StructTypeDef font = { FONT8x8_XSIZE, FONT8x8_YSIZE, (void*)font8x8_basic, 0, 0xFFFFFFFF };
 
-/* Object properties */
+/* Objects */
+bodies_t Bodies;
+
+/* Mass center marker */
 typedef struct
 {
-	//phisical parameters
+	double x, y, px, py, weight;
 	uint32_t color;
-	uint16_t r; //radius
-	double weight;
+	bool erased; //marker moved on the last frame and was erased at ex, ey
+	double ex, ey;
+}mass_center_t;
+
+static mass_center_t _mass_center = { .x = 100,.y = 100,.px = 100,.py = 100,.weight = 0, .color = YELLOW32 };
 
-	//previous positions
-	double x, y, px, py, vx, vy, ax, ay;
+#define OVERLAY_PERIOD	1000000000ull //ns between statistics updates
+#define OVERLAY_TEXT	128
 
-	//object name
-	const char * name;
-	bool isMoving;
+/*
+ * Statistics overlay, transparent text in the top left corner. Text is
+ * updated once per period, it is redrawn only when it changed or
+ * something was drawn under it.
+ */
+static struct
+{
+	char text[OVERLAY_TEXT];
+	uint16_t width, height; //box of the text on the screen
+	bool changed; //old text was erased in this frame
+	uint64_t since, frames; //start of the period, frames in it
+}overlay;
+
+static Font_StructTypeDef overlay_font = { FONT8x8_XSIZE, FONT8x8_YSIZE, (void*)font8x8_basic, WHITE32, 0, true };
+
+/*
+ * Renderer state by body id: what is on the screen and the snapshot
+ * before the current one. On a screen the simulation runs in its own
+ * thread and publishes snapshots, the renderer draws the latest one and
+ * interpolates positions from the one before, so motion stays smooth
+ * when frames and steps do not line up. Without a screen, and for
+ * benchmarks, both run in turns on one thread without interpolation.
+ */
+static struct
+{
+	int16_t * px, * py; //pixel position drawn
+	uint16_t * pr; //radius drawn, 0 = not on the screen
+	uint32_t * pcolor; //color drawn
+	double * x, * y; //screen position in this frame
+	double * prev_x, * prev_y, * last_x, * last_y; //bodies of the previous and current snapshot
+	uint8_t * prev_alive, * last_alive;
+	double prev_mass_x, prev_mass_y, last_mass_x, last_mass_y;
+	uint64_t prev_time, last_time; //0 = none
+	bool interpolate;
+	void * arena;
+}view;
+
+/* Simulation thread */
+static struct
+{
+	pthread_t thread;
+	bool done; //last snapshot is published
+}sim;
 
-	//after impact 2 objects become 1
-	bool isAlive;
+/* Simulation clock, a resumed run goes on from the checkpoint */
+static struct
+{
+	uint64_t first; //step the run started at
+	uint64_t step; //steps done
+	double time; //sum of dt
+	bool failed; //a stage ran out of memory, no more steps
+}run;
 
-	bool isMassCenter;
+#define MASS_CHUNK	1024 //mass center partial sums, fixed so result does not depend on thread count
 
-	bool fillLastTime;
-}object_t;
+static struct
+{
+	double * x, * y;
+	uint32_t size;
+}mass_partial;
 
-/* Objects */
-object_t ** Objects;
+/* Impact found during the step, t is time of first contact 0..1 */
+typedef struct
+{
+	double t;
+	uint32_t i, j;
+}impact_event_t;
+
+static struct
+{
+	struct
+	{
+		impact_event_t * event;
+		uint32_t size, capacity;
+		bool failed; //out of memory, impacts of the step are incomplete
+	}list[WORKERS_MAX]; //one list per worker
+	impact_event_t * event; //all of them, sorted by time
+	uint32_t capacity;
+}impact;
+
+/* Block time step integrator */
+static struct
+{
+	uint32_t * list; //bodies whose step ends on this sub-step
+	uint32_t size, capacity;
+	uint32_t substep, substeps; //substeps = 2^levels
+	bool ready; //accelerations are valid
+}active;
+
+/* Bodies to compute gravity for, list is NULL for all */
+typedef struct
+{
+	bodies_t * bodies;
+	const uint32_t * list;
+}gravity_targets_t;
+
+/* Broadphase walk of one worker */
+typedef struct
+{
+	bodies_t * bodies;
+	uint8_t worker;
+}impact_walk_t;
 
 /* Predefined objects */
 object_t planets[] = {
@@ -60,28 +181,71 @@ object_t planets[] = {
 
 
 /* Functions */
-static object_t ** create_predefined_objects(uint16_t * amount);
-static object_t ** create_random_objects(uint16_t amount);
-static object_t * create_random_object(void);
-static double distance(object_t * o1, object_t * o2);
-static double distanceSquare(object_t * o1, object_t * o2);
-static bool check_impact(object_t * o1, object_t * o2);
-static void move(object_t ** objects, uint16_t object_s);
-static void draw_object(object_t ** objects, uint16_t object_s);
-static void border_impact(object_t * object);
-static object_t * mass_center(object_t ** objects, uint16_t object_s);
-static void gravity(object_t * object, object_t * ref_object);
-static void process_impact(object_t * object, object_t * ref_object);
-static void process_impact_all(object_t ** object, uint16_t object_s);
-static void gravity_object_to_object(object_t ** object, uint16_t object_s);
-static void gravity_oject_to_massCenter(object_t ** object, uint16_t object_s, object_t * massCenter);
+static bool create_predefined_objects(bodies_t * bodies);
+static bool resume(bodies_t * bodies, const char * file);
+static bool create_random_objects(bodies_t * bodies, uint32_t amount);
+static double distanceSquare(bodies_t * bodies, uint32_t i, uint32_t j);
+static bool check_impact(bodies_t * bodies, uint32_t i, uint32_t j, double * t);
+static void move(bodies_t * bodies);
+static void simulate(bodies_t * bodies, uint64_t step);
+static void publish(bodies_t * bodies, uint64_t step, uint64_t time);
+static void * simulation_thread(void * arg);
+static bool run_threaded(void);
+static void sleep_until(uint64_t time);
+static bool view_init(uint32_t size);
+static void view_take(const snapshot_t * s);
+static double view_alpha(const snapshot_t * s);
+static void view_free(void);
+static void render(const snapshot_t * s, double alpha);
+static void draw_object(const snapshot_t * s, double alpha);
+static void mass_center_draw(double mass_x, double mass_y);
+static void border_impact(bodies_t * bodies, uint32_t i);
+static mass_center_t * mass_center(bodies_t * bodies);
+static void gravity(bodies_t * bodies, uint32_t i, uint32_t j);
+static void process_impact(bodies_t * bodies, uint32_t i, uint32_t j);
+static void process_impact_all(bodies_t * bodies);
+static void gravity_object_to_object(bodies_t * bodies, const uint32_t * list, uint32_t list_s);
+static void gravity_all(bodies_t * bodies, const uint32_t * list, uint32_t list_s);
+static bool gravity_engine(bodies_t * bodies, const uint32_t * list, uint32_t list_s);
+static void gravity_check(bodies_t * bodies);
+static double gravity_error(bodies_t * bodies);
+static double gravity_probe(bool vertical);
+static void gravity_oject_to_massCenter(bodies_t * bodies, mass_center_t * massCenter);
 static uint32_t mix_color(uint32_t c1, uint32_t c2, double w1, double w2);
+static uint8_t time_level(bodies_t * bodies, uint32_t i);
+static void move_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void kick_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void drift_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void mass_center_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static void overlay_update(const snapshot_t * s);
+static void camera_update(double mass_x, double mass_y);
+static uint16_t camera_radius(uint16_t r);
+static bool camera_splat(uint16_t r);
+static void overlay_draw(void);
+static void impact_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static bool impact_found(void * ctx, uint32_t i, uint32_t j);
+static int compare_impact(const void * a, const void * b);
+static void gravity_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+static bool space_run(uint32_t objects_s, uint32_t backColor);
+static void space_free(void);
 
 /**
- * Initialize and run simulation
+ * Initialize and run simulation, everything it allocated is released
+ * on any way out. Returns false if the run failed to start or to write
+ * its results.
  */
-void space_init(uint16_t objects_s, uint32_t backColor)
+bool space_init(uint32_t objects_s, uint32_t backColor)
 {
+	const bool ok = space_run(objects_s, backColor);
+
+	space_free();
+	return ok;
+}
+
+static bool space_run(uint32_t objects_s, uint32_t backColor)
+{
+	bool ok = true;
+
 	GetScreenSize(&lcd_width, &lcd_heigh);
 	printf("Screen: %u x %u\n", lcd_width, lcd_heigh);
 	screen_center.X = lcd_width / 2;
@@ -90,337 +254,1343 @@ void space_init(uint16_t objects_s, uint32_t backColor)
 	ClearScreen(lcd_backColor = backColor);
 
 	SetFont((void*)&font);
+	sprite_init(FrameBufferRaster() ? SPRITE_CACHE_SIZE : 0, &font);
+	if (FrameBufferRaster())
+		splat_init(lcd_width, lcd_heigh);
+
+	if (space_options.gravity == GRAVITY_SIMD)
+		printf("Gravity kernel: %s\n", simd_kernel());
+
+	//run with parameter ('./ps 2') will init 2 random objects, ('./ps file') loads them, otherwise will use predefined ones
+	if (space_options.resume)
+	{
+		if (!resume(&Bodies, space_options.resume))
+			return false;
+	}
+	else if (space_options.scenario)
+	{
+		const char * result = scenario_load(space_options.scenario, &Bodies);
+
+		if (strcmp(result, "OK"))
+		{
+			printf("Scenario %s: %s\n", space_options.scenario, result);
+			return false;
+		}
+		printf("Loaded %u objects from %s\n", Bodies.size, space_options.scenario);
+	}
+	else if (objects_s)
+	{
+		if (!create_random_objects(&Bodies, objects_s))
+			return false;
+	}
+	else if (!create_predefined_objects(&Bodies))
+		return false;
+
+	if (space_options.bench && (!space_options.steps || !bench_init(space_options.steps)))
+	{
+		printf("Benchmark needs a step count\n");
+		return false;
+	}
+
+	if (!snapshot_init(&Bodies) || !view_init(Bodies.capacity))
+	{
+		printf("Fail to allocate snapshots\n");
+		return false;
+	}
+
+	if (space_options.trajectory)
+	{
+		const char * result = trajectory_open(space_options.trajectory, Bodies.capacity);
+
+		if (strcmp(result, "OK"))
+		{
+			printf("Trajectory: %s\n", result);
+			return false;
+		}
+		trajectory_record(&Bodies, run.step); //initial conditions
+	}
+
+	if (space_options.impacts || !space_options.bench)
+	{
+		const char * result = impacts_open(&Bodies, space_options.impacts, !space_options.bench);
+
+		if (strcmp(result, "OK"))
+		{
+			printf("Impacts: %s\n", result);
+			return false;
+		}
+	}
+
+	if (FrameBufferVisible() && !space_options.bench)
+		ok = run_threaded();
+	else
+		for (uint64_t step = run.first; (!space_options.steps || step != run.first + space_options.steps) && !run.failed; step++)
+		{
+			bool fresh;
+
+			simulate(&Bodies, step);
+			publish(&Bodies, step, bench_clock());
+			render(snapshot_take(&fresh), 1);
+			bench_step();
+		}
 
-	//run with parameter ('./ps 2') will init 2 random objects, otherwise will use predefined ones
-	Objects = objects_s ? create_random_objects(objects_s) : create_predefined_objects(&objects_s);
+	ok &= !run.failed;
 
-	while (1)
+	//a failed step is left half done, it is not reported nor saved
+	if (space_options.bench && !run.failed)
 	{
-		usleep(10000);
-		//gravity_oject_to_massCenter(Objects, objects_s, _mass_center);
+		char config[256];
+
+		snprintf(config, sizeof(config), "\"bodies\": %u, \"seed\": %u, \"gravity\": \"%s\", \"threads\": %u, " \
+			"\"levels\": %u, \"screen\": \"%ux%u\", \"display\": \"%s\"", Bodies.capacity, space_options.seed, \
+			gravity_names[space_options.gravity], workers_count(), space_options.levels, lcd_width, lcd_heigh, \
+			FrameBufferBackend());
+
+		if (!bench_report(space_options.bench, config))
+		{
+			printf("Fail to write %s\n", space_options.bench);
+			ok = false;
+		}
 
-		// MOVEMENT
-		move(Objects, objects_s);
+		bench_free();
+	}
 
-		draw_object(Objects, objects_s);
+	if (space_options.impacts || !space_options.bench)
+	{
+		uint64_t events, dropped;
 
-		// BORDER IMPACT
-		//border_impact(Objects[i]);
+		impacts_close(&events, &dropped);
+		if (space_options.impacts || dropped)
+			printf("Impacts: %llu merges, %llu dropped\n", (unsigned long long)events, (unsigned long long)dropped);
+	}
 
-		// IMPACT PROCESS
-		process_impact_all(Objects, objects_s);
+	if (space_options.trajectory)
+	{
+		uint64_t frames, dropped, bytes;
 
-		// GRAVITY FOR EACH OBJECT OR TO MASS CENTER
-		gravity_object_to_object(Objects, objects_s);
+		trajectory_close(&frames, &dropped, &bytes);
+		printf("Trajectory: %llu frames, %llu dropped, %.1f MB\n", (unsigned long long)frames, \
+			(unsigned long long)dropped, bytes / 1048576.0);
+	}
 
-		/* Center mass -> screen center */
-		object_t * _mass_center = mass_center(Objects, objects_s);
-		screen_center.X = lcd_width / 2 - _mass_center->x;
-		screen_center.Y = lcd_heigh / 2 - _mass_center->y;
+	if (space_options.checkpoint && !run.failed)
+	{
+		const checkpoint_state_t state = { .step = run.step, .time = run.time, .dt = space_options.dt, \
+			.weight = _mass_center.weight, .seed = space_options.seed, .levels = space_options.levels };
 
-		FrameBufferUpdate();
+		if (checkpoint_save(space_options.checkpoint, &Bodies, &state))
+			printf("Checkpoint at step %llu: %s\n", (unsigned long long)run.step, space_options.checkpoint);
+		else
+		{
+			printf("Fail to write %s\n", space_options.checkpoint);
+			ok = false;
+		}
 	}
+
+	return ok;
 }
 
 /**
- * Create object array from 'planets' array
+ * Teardown: writer threads (what they hold is written out), body store
+ * (or its checkpoint mapping), engines and buffers of the stages. Safe
+ * to call for whatever was not allocated.
  */
-static object_t ** create_predefined_objects(uint16_t * amount)
+static void space_free(void)
 {
-	const uint8_t _objects_s = sizeof(planets) / sizeof(object_t); //amount of objects defined in 'planets[]' array
+	impacts_close(NULL, NULL);
+	trajectory_close(NULL, NULL, NULL);
+
+	bench_free();
+	sprite_free();
+	splat_free();
+	snapshot_free();
+	view_free();
+
+	tree_free();
+	pm_free();
+	simd_free();
+	broadphase_free();
+	morton_free();
+
+	for (uint8_t w = 0; w != WORKERS_MAX; w++)
+		free(impact.list[w].event);
+	free(impact.event);
+	free(active.list);
+	free(mass_partial.x);
+	free(mass_partial.y);
+	memset(&impact, 0, sizeof(impact));
+	memset(&active, 0, sizeof(active));
+	memset(&mass_partial, 0, sizeof(mass_partial));
+
+	bodies_free(&Bodies);
+}
 
-	object_t ** _objects = malloc(sizeof(object_t *) * _objects_s);
+/**
+ * One step of the simulation: reorder, move, impacts and mass center
+ */
+static void simulate(bodies_t * bodies, uint64_t step)
+{
+	uint64_t t = bench_clock();
 
-	*amount = _objects_s;
+	// CACHE LOCALITY: bodies close in space -> close in memory
+	if (space_options.reorder && step % space_options.reorder == 0 && !morton_reorder(bodies))
+	{
+		printf("Fail to allocate reorder buffers, bodies stay in place\n");
+		space_options.reorder = 0;
+	}
+	t = bench_lap(BENCH_REORDER, t);
+
+	//gravity_oject_to_massCenter(bodies, _mass_center);
+
+	// MOVEMENT
+	move(bodies);
+	t = bench_lap(BENCH_MOVE, t);
+	if (run.failed) //later stages would run on a half moved state
+		return;
+
+	// BORDER IMPACT
+	//border_impact(bodies, i);
+
+	// IMPACT PROCESS
+	process_impact_all(bodies);
+	t = bench_lap(BENCH_IMPACT, t);
+
+	mass_center(bodies);
+	bench_lap(BENCH_MASS_CENTER, t);
 
-	printf("Memory allocated for %u objects at %p\n", _objects_s, _objects);
+	run.step = step + 1;
+	run.time += space_options.dt;
+	trajectory_record(bodies, run.step);
+}
 
-	for (uint8_t i = 0; i != _objects_s; i++)
+/**
+ * State after the step goes to the renderer, time is when the step was due
+ */
+static void publish(bodies_t * bodies, uint64_t step, uint64_t time)
+{
+	snapshot_t * s = snapshot_back();
+
+	snapshot_capture(s, bodies);
+	s->step = step;
+	s->time = time;
+	s->mass_x = _mass_center.x;
+	s->mass_y = _mass_center.y;
+	snapshot_publish();
+}
+
+/**
+ * Steps with fixed timestep, step k is due at start + k / rate. Deadlines
+ * are absolute, so a late step does not delay the ones after it, they
+ * run back to back until the schedule is met again.
+ */
+static void * simulation_thread(void * arg)
+{
+	const uint64_t period = space_options.rate > 0 ? 1e9 / space_options.rate : 0;
+	uint64_t due = bench_clock();
+
+	for (uint64_t step = run.first; (!space_options.steps || step != run.first + space_options.steps) && !run.failed; step++)
 	{
-		_objects[i] = &planets[i];
+		if (period)
+			sleep_until(due += period);
 
-		// automatically calculate radius if needed (r == 0)
-		if (_objects[i]->r == 0) _objects[i]->r = strlen(_objects[i]->name) * font.FontXsize / 2 + 5; //5px gap (-o-)
+		simulate(&Bodies, step);
+		publish(&Bodies, step, period ? due : bench_clock());
+	}
 
-		//initial position put to 0 (undefined)
-		_objects[i]->px = 0;
-		_objects[i]->py = 0;
+	__atomic_store_n(&sim.done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
 
-		//object can move
-		_objects[i]->isMoving = true;
-		_objects[i]->isAlive = true;
-		_objects[i]->isMassCenter = false;
-		_objects[i]->fillLastTime = false;
+/**
+ * Simulation in its own thread, frames at SPACE_FRAME_RATE on this one. A slow
+ * frame only makes the renderer skip snapshots, steps go on. The last
+ * snapshot is drawn when the simulation is done.
+ */
+static bool run_threaded(void)
+{
+	const uint64_t period = 1000000000ull / SPACE_FRAME_RATE;
+	uint64_t due = bench_clock();
+	bool done = false;
 
-		printf("Name: %s\tx = %4.0f\ty = %4.0f\tr = %u\tx speed = %3.0f\ty speed = %3.0f\tWeight = %4.0f\n", \
-			_objects[i]->name, _objects[i]->x, _objects[i]->y, _objects[i]->r, _objects[i]->vx, _objects[i]->vy, _objects[i]->weight);
+	view.interpolate = space_options.rate > 0;
+	if (pthread_create(&sim.thread, NULL, simulation_thread, NULL))
+	{
+		printf("Fail to start simulation thread\n");
+		return false;
 	}
 
-	return _objects;
+	while (!done)
+	{
+		bool fresh;
+
+		done = __atomic_load_n(&sim.done, __ATOMIC_ACQUIRE);
+
+		const snapshot_t * s = snapshot_take(&fresh);
+		if (s)
+		{
+			if (fresh)
+				view_take(s);
+			render(s, done ? 1 : view_alpha(s));
+		}
+
+		if (done)
+			break;
+
+		//skip frames that are already late
+		const uint64_t now = bench_clock();
+		due = due + period > now ? due + period : now;
+		sleep_until(due);
+	}
+
+	pthread_join(sim.thread, NULL);
+	return true;
+}
+
+static void sleep_until(uint64_t time)
+{
+	const struct timespec ts = { .tv_sec = time / 1000000000ull, .tv_nsec = time % 1000000000ull };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/**
+ * Renderer state for size ids, nothing on the screen
+ */
+static bool view_init(uint32_t size)
+{
+	const size_t n = size ? size : 1;
+	const size_t total = (2 * sizeof(int16_t) + sizeof(uint16_t) + sizeof(uint32_t) + 6 * sizeof(double) + 2) * n;
+	uint8_t * arena = calloc(1, total);
+
+	view_free();
+	if (!arena)
+		return false;
+
+	//widest first, everything stays aligned
+	view.arena = arena;
+	view.x = (double *)arena; arena += sizeof(double) * n;
+	view.y = (double *)arena; arena += sizeof(double) * n;
+	view.prev_x = (double *)arena; arena += sizeof(double) * n;
+	view.prev_y = (double *)arena; arena += sizeof(double) * n;
+	view.last_x = (double *)arena; arena += sizeof(double) * n;
+	view.last_y = (double *)arena; arena += sizeof(double) * n;
+	view.pcolor = (uint32_t *)arena; arena += sizeof(uint32_t) * n;
+	view.px = (int16_t *)arena; arena += sizeof(int16_t) * n;
+	view.py = (int16_t *)arena; arena += sizeof(int16_t) * n;
+	view.pr = (uint16_t *)arena; arena += sizeof(uint16_t) * n;
+	view.prev_alive = arena; arena += n;
+	view.last_alive = arena;
+
+	return true;
 }
 
 /**
- * Create random object array
+ * New snapshot, the last one becomes the previous. Bodies are copied, the
+ * snapshot goes back to the simulation on the next take.
  */
-static object_t ** create_random_objects(uint16_t amount)
+static void view_take(const snapshot_t * s)
 {
-	object_t ** _objects = malloc(sizeof(object_t *) * amount);
+	if (!view.interpolate)
+		return;
+
+	double * x = view.prev_x, * y = view.prev_y;
+	uint8_t * alive = view.prev_alive;
+
+	view.prev_x = view.last_x;
+	view.prev_y = view.last_y;
+	view.prev_alive = view.last_alive;
+	view.prev_mass_x = view.last_mass_x;
+	view.prev_mass_y = view.last_mass_y;
+	view.prev_time = view.last_time;
+
+	memcpy(x, s->x, sizeof(double) * s->size);
+	memcpy(y, s->y, sizeof(double) * s->size);
+	memcpy(alive, s->alive, s->size);
+	view.last_x = x;
+	view.last_y = y;
+	view.last_alive = alive;
+	view.last_mass_x = s->mass_x;
+	view.last_mass_y = s->mass_y;
+	view.last_time = s->time;
+}
 
-	printf("Memory allocated for %u objects at %p\n", amount, _objects);
+/**
+ * Where the frame is between the previous and the current snapshot,
+ * 0..1. Frames show the state one step ago, so there is always a newer
+ * snapshot to move to.
+ */
+static double view_alpha(const snapshot_t * s)
+{
+	if (!view.interpolate || !view.prev_time || s->time <= view.prev_time)
+		return 1;
+
+	const double shown = bench_clock() - 1e9 / space_options.rate;
+	const double alpha = (shown - view.prev_time) / (s->time - view.prev_time);
 
-	for (uint8_t i = 0; i != amount; i++)
-		_objects[i] = create_random_object();
+	return alpha < 0 ? 0 : alpha > 1 ? 1 : alpha;
+}
 
-	return _objects;
+static void view_free(void)
+{
+	free(view.arena);
+	memset(&view, 0, sizeof(view));
 }
 
 /**
- * Create random object
+ * Draw snapshot and present it, alpha 1 shows it as is
  */
-static object_t * create_random_object(void)
+static void render(const snapshot_t * s, double alpha)
 {
-	static uint8_t i = 0;
-	object_t * object = malloc(sizeof(object_t));
+	uint64_t t = bench_clock();
+	double mass_x = s->mass_x, mass_y = s->mass_y;
 
-	object->r = rand() % (radius[1] - radius[0]) + radius[0];
-	object->x = rand() % (lcd_width - 2 * object->r) + object->r;
-	object->y = rand() % (lcd_heigh - 2 * object->r) + object->r;
-	object->vx = rand() % (speed_x10[1] - speed_x10[0]) + speed_x10[0];
-	object->vy = rand() % (speed_x10[1] - speed_x10[0]) + speed_x10[0];
-	object->color = colors[rand() % (sizeof(colors) / sizeof(colors[0]))];
-	object->px = 0;
-	object->py = 0;
-	object->weight = rand() % (weight[1] - weight[0]) + weight[0];
-	object->isMoving = true;
-	object->isAlive = true;
-	object->isMassCenter = false;
-	object->fillLastTime = false;
+	if (alpha < 1)
+	{
+		mass_x -= (mass_x - view.prev_mass_x) * (1 - alpha);
+		mass_y -= (mass_y - view.prev_mass_y) * (1 - alpha);
+	}
 
-	if (i < (sizeof(names) / sizeof(*names)))
-		object->name = names[i];
-	else
+	if (space_options.overlay)
+		overlay_update(s);
+	camera_update(mass_x, mass_y);
+	draw_object(s, alpha);
+	mass_center_draw(mass_x, mass_y);
+	t = bench_lap(BENCH_DRAW, t);
+
+	if (space_options.overlay)
+		overlay_draw();
+	FrameBufferUpdate();
+	bench_lap(BENCH_UPDATE, t);
+}
+
+/**
+ * Create object array from 'planets' array
+ */
+static bool create_predefined_objects(bodies_t * bodies)
+{
+	const uint32_t _objects_s = sizeof(planets) / sizeof(object_t); //amount of objects defined in 'planets[]' array
+
+	if (!bodies_alloc(bodies, _objects_s))
 	{
-		object->name = malloc(20);
-		sprintf((void*)object->name, "Object %u", i);
+		printf("Fail to allocate %u objects\n", _objects_s);
+		return false;
 	}
-	i++;
 
-	object->vx *= rand() > rand() ? 1 : -1;
-	object->vy *= rand() > rand() ? 1 : -1;
+	printf("Memory allocated for %u objects at %p\n", _objects_s, bodies->arena);
+
+	for (uint32_t i = 0; i != _objects_s; i++)
+	{
+		object_t * object = &planets[i];
+
+		// automatically calculate radius if needed (r == 0)
+		if (object->r == 0) object->r = strlen(object->name) * font.FontXsize / 2 + 5; //5px gap (-o-)
 
-	printf("Name: %s\tx = %4.0f\ty = %4.0f\tr = %u\tx speed = %3.0f\ty speed = %3.0f\tWeight = %3.0f\n", \
-		object->name, object->x, object->y, object->r, object->vx, object->vy, object->weight);
+		bodies_set(bodies, i, object);
 
-	return object;
+		if (!space_options.bench)
+			printf("Name: %s\tx = %4.0f\ty = %4.0f\tr = %u\tx speed = %3.0f\ty speed = %3.0f\tWeight = %4.0f\n", \
+				object->name, object->x, object->y, object->r, object->vx, object->vy, object->weight);
+	}
+	return true;
 }
 
-static double distance(object_t * o1, object_t * o2)
+/**
+ * Bodies and clock from a checkpoint. Time step, levels and seed are the
+ * saved ones, accelerations too, so the run goes on as if never stopped.
+ */
+static bool resume(bodies_t * bodies, const char * file)
 {
-	double dx = o1->x - o2->x;
-	double dy = o1->y - o2->y;
-	return sqrt(dx * dx + dy * dy);
+	checkpoint_state_t state;
+	const char * result = checkpoint_load(file, bodies, &state);
+
+	if (strcmp(result, "OK"))
+	{
+		printf("Checkpoint %s: %s\n", file, result);
+		return false;
+	}
+
+	printf("Resumed %u objects at step %llu from %s\n", bodies->size, (unsigned long long)state.step, file);
+
+	run.first = run.step = state.step;
+	run.time = state.time;
+	space_options.dt = state.dt;
+	space_options.levels = state.levels;
+	space_options.seed = state.seed;
+	_mass_center.weight = state.weight;
+	active.ready = state.step != 0;
+
+	return true;
 }
 
-static double distanceSquare(object_t * o1, object_t * o2)
+/**
+ * Create random object array of the model, on the workers
+ */
+static bool create_random_objects(bodies_t * bodies, uint32_t amount)
 {
-	double dx = o1->x - o2->x;
-	double dy = o1->y - o2->y;
+	if (!generate(bodies, space_options.model, amount, space_options.seed, lcd_width, lcd_heigh))
+	{
+		printf("Fail to allocate %u objects\n", amount);
+		return false;
+	}
+
+	printf("Memory allocated for %u objects at %p, model %s\n", amount, bodies->arena, model_names[space_options.model]);
+
+	if (space_options.tolerance) //with the engine check
+		printf("Generator check, %s on %u workers: %s\n", model_names[space_options.model], workers_count(), \
+			generate_check(space_options.model, amount, space_options.seed, lcd_width, lcd_heigh));
+
+	for (uint32_t i = 0; i != amount && !space_options.bench; i++)
+		printf("Name: %s\tx = %4.0f\ty = %4.0f\tr = %u\tx speed = %3.0f\ty speed = %3.0f\tWeight = %3.0f\n", \
+			bodies->info[i].name, bodies->x[i], bodies->y[i], bodies->info[i].r, bodies->vx[i], bodies->vy[i], bodies->m[i]);
+
+	return true;
+}
+
+static double distanceSquare(bodies_t * bodies, uint32_t i, uint32_t j)
+{
+	double dx = bodies->x[i] - bodies->x[j];
+	double dy = bodies->y[i] - bodies->y[j];
 	return dx * dx + dy * dy;
 }
 
-static bool check_impact(object_t * o1, object_t * o2)
+/**
+ * Swept circles: both objects move along straight lines during the step,
+ * t (0..1) is the first moment they touch. Fast objects can not pass
+ * through each other between two steps.
+ */
+static bool check_impact(bodies_t * bodies, uint32_t i, uint32_t j, double * t)
+{
+	double r = bodies->info[i].r + bodies->info[j].r;
+
+	/* relative position at step start and relative motion */
+	double dx = bodies->x0[i] - bodies->x0[j];
+	double dy = bodies->y0[i] - bodies->y0[j];
+	double mx = (bodies->x[i] - bodies->x0[i]) - (bodies->x[j] - bodies->x0[j]);
+	double my = (bodies->y[i] - bodies->y0[i]) - (bodies->y[j] - bodies->y0[j]);
+
+	/* |d + m * t|^2 = r^2 */
+	double a = mx * mx + my * my;
+	double b = dx * mx + dy * my;
+	double c = dx * dx + dy * dy - r * r;
+
+	if (c < 0) //already touching
+	{
+		*t = 0;
+		return true;
+	}
+
+	if (b >= 0 || a == 0) //moving apart
+		return false;
+
+	double d = b * b - a * c;
+	if (d < 0) //passing by
+		return false;
+
+	*t = (-b - sqrt(d)) / a;
+
+	return *t <= 1 ? true : false;
+}
+
+/**
+ * Kick-drift-kick leapfrog with block time steps. The step dt is split
+ * into 2^levels sub-steps, body of level L has step dt / 2^L and is
+ * kicked only at its own step boundaries. All bodies drift every sub-step,
+ * gravity is evaluated only for bodies whose step ends there.
+ */
+static void move(bodies_t * bodies)
+{
+	active.substeps = 1u << space_options.levels;
+
+	if (!active.ready)
+	{
+		gravity_all(bodies, NULL, 0);
+		if (run.failed)
+			return;
+		for (uint32_t i = 0; i != bodies->size; i++)
+			bodies->level[i] = time_level(bodies, i);
+		active.ready = true;
+	}
+
+	if (bodies->size > active.capacity)
+	{
+		uint32_t * list = realloc(active.list, sizeof(uint32_t) * bodies->size);
+
+		if (!list)
+		{
+			printf("Fail to allocate block time step list\n");
+			run.failed = true;
+			return;
+		}
+		active.list = list;
+		active.capacity = bodies->size;
+	}
+
+	workers_run(move_job, bodies, bodies->size, 0);
+
+	for (active.substep = 0; active.substep != active.substeps; active.substep++)
+	{
+		/* opening kick of bodies starting own step, drift of all */
+		workers_run(kick_job, bodies, bodies->size, 0);
+		workers_run(drift_job, bodies, bodies->size, 0);
+
+		/* bodies finishing own step, in store order */
+		const uint32_t end = active.substep + 1;
+		uint32_t alive = 0;
+
+		active.size = 0;
+		for (uint32_t i = 0; i != bodies->size; i++)
+		{
+			if (!bodies->alive[i])
+				continue;
+
+			alive++;
+			if (end % (active.substeps >> bodies->level[i]) == 0)
+				active.list[active.size++] = i;
+		}
+
+		if (!active.size)
+			continue;
+
+		if (active.size == alive)
+			gravity_all(bodies, NULL, 0);
+		else
+			gravity_all(bodies, active.list, active.size);
+		if (run.failed)
+			return;
+
+		/* closing kick, then new level */
+		for (uint32_t k = 0; k != active.size; k++)
+		{
+			uint32_t i = active.list[k];
+			double h = space_options.dt / (2 << bodies->level[i]);
+			uint8_t level = time_level(bodies, i);
+
+			bodies->vx[i] += bodies->ax[i] * h;
+			bodies->vy[i] += bodies->ay[i] * h;
+
+			//finer is always allowed, coarser only on its own step boundary
+			while (bodies->level[i] > level && end % (active.substeps >> (bodies->level[i] - 1)) == 0)
+				bodies->level[i]--;
+			if (bodies->level[i] < level)
+				bodies->level[i] = level;
+		}
+	}
+}
+
+/**
+ * Level of body i from its acceleration: dt / 2^level <= eta * sqrt(r / |a|)
+ */
+static uint8_t time_level(bodies_t * bodies, uint32_t i)
+{
+	double a = sqrt(bodies->ax[i] * bodies->ax[i] + bodies->ay[i] * bodies->ay[i]);
+	double want = space_options.eta * sqrt(bodies->info[i].r / a);
+	uint8_t level = 0;
+
+	while (level < space_options.levels && space_options.dt / (1u << level) > want)
+		level++;
+
+	return level;
+}
+
+/**
+ * Start of the step, position is kept for impact sweep
+ */
+static void move_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
 {
-	return distance(o1, o2) < (o1->r + o2->r) ? true : false;
+	bodies_t * bodies = ctx;
+
+	for (uint32_t i = begin; i != end; i++)
+	{
+		if (!bodies->info[i].isMoving)
+			continue;
+
+		bodies->x0[i] = bodies->x[i];
+		bodies->y0[i] = bodies->y[i];
+	}
 }
 
-static void move(object_t ** objects, uint16_t object_s)
+/**
+ * acceleration -> speed, half of own step
+ */
+static void kick_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
 {
-	for (uint16_t i = 0; i != object_s; i++)
+	bodies_t * bodies = ctx;
+
+	for (uint32_t i = begin; i != end; i++)
 	{
-		if (!objects[i]->isMoving)
+		if (!bodies->info[i].isMoving || !bodies->alive[i])
 			continue;
 
-		/* acceleration -> speed */
-		objects[i]->vx += objects[i]->ax;
-		objects[i]->vy += objects[i]->ay;
+		if (active.substep % (active.substeps >> bodies->level[i]))
+			continue;
+
+		double h = space_options.dt / (2 << bodies->level[i]);
+
+		bodies->vx[i] += bodies->ax[i] * h;
+		bodies->vy[i] += bodies->ay[i] * h;
+	}
+}
+
+/**
+ * speed -> position, one sub-step
+ */
+static void drift_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	bodies_t * bodies = ctx;
+	const double h = space_options.dt / active.substeps;
+
+	for (uint32_t i = begin; i != end; i++)
+	{
+		if (!bodies->info[i].isMoving)
+			continue;
 
-		/* speed -> position */
-		objects[i]->x += objects[i]->vx;
-		objects[i]->y += objects[i]->vy;
+		bodies->x[i] += bodies->vx[i] * h;
+		bodies->y[i] += bodies->vy[i] * h;
 	}
 }
 
-static void draw_object(object_t ** objects, uint16_t object_s)
+/**
+ * Erase bodies that changed on the screen, then draw them. A body with
+ * the same pixel position, radius and color is left as is, unless
+ * something was erased or drawn over it in this frame. Bodies smaller
+ * than space_options.splat pixels are splatted as points, all of them
+ * again every frame, before circles are drawn. Bodies are in id order.
+ */
+static void draw_object(const snapshot_t * s, double alpha)
 {
-	for (uint16_t i = 0; i != object_s; i++)
+	//relative -> absolute coordinates, moved back towards the previous snapshot
+	for (uint32_t i = 0; i != s->size; i++)
 	{
-		double x = screen_center.X + objects[i]->x, y = screen_center.Y + objects[i]->y; //relative -> absolute coordinates
+		double x = s->x[i], y = s->y[i];
 
-		if (objects[i]->fillLastTime)
+		if (alpha < 1 && s->alive[i] && view.prev_alive[i])
 		{
-			objects[i]->fillLastTime = false;
-			DrawFilledCircle32(objects[i]->px, objects[i]->py, objects[i]->r, lcd_backColor); //remove object last time
+			x -= (x - view.prev_x[i]) * (1 - alpha);
+			y -= (y - view.prev_y[i]) * (1 - alpha);
 		}
+		view.x[i] = camera.x0 + x * camera.zoom;
+		view.y[i] = camera.y0 + y * camera.zoom;
+	}
 
-		if (!objects[i]->isAlive)
+	for (uint32_t i = 0; i != s->size; i++)
+	{
+		const double x = view.x[i], y = view.y[i];
+		uint16_t r = camera_radius(s->r[i]);
+
+		if (!view.pr[i])
 			continue;
 
-		if (objects[i]->px || objects[i]->py)
-			DrawFilledCircle32(objects[i]->px, objects[i]->py, objects[i]->r, lcd_backColor); //remove object before redraw
+		if (s->alive[i] && (int16_t)x == view.px[i] && (int16_t)y == view.py[i] && \
+			r == view.pr[i] && s->color[i] == view.pcolor[i] && !camera_splat(s->r[i]) && \
+			!(x < r + GAP || y < r + GAP || x > lcd_width - r - GAP || y > lcd_heigh - r - GAP))
+			continue; //same pixels
 
-		if (x < objects[i]->r + GAP || y < objects[i]->r + GAP || x > lcd_width - objects[i]->r - GAP || y > lcd_heigh - objects[i]->r - GAP)
-			continue;
+		//merged or gone, looks different from now on
+		if (!s->alive[i] || r != view.pr[i] || s->color[i] != view.pcolor[i])
+			sprite_drop(view.pr[i], view.pcolor[i], s->name[i]);
 
-		objects[i]->px = x;
-		objects[i]->py = y;
+		DrawFilledCircle32(view.px[i], view.py[i], view.pr[i], lcd_backColor); //remove object before redraw
+		view.pr[i] = 0;
+	}
+
+	splat_erase(lcd_backColor);
+	splat_draw(s, view.x, view.y, camera.zoom, space_options.splat);
 
-		if (!objects[i]->isAlive) continue;
+	for (uint32_t i = 0; i != s->size; i++)
+	{
+		double x = view.x[i], y = view.y[i];
+		uint16_t r = camera_radius(s->r[i]);
 
-		DrawFilledCircle32(x, y, objects[i]->r, objects[i]->color);
+		if (!s->alive[i] || camera_splat(s->r[i]))
+			continue;
 
-		if (objects[i]->name)
+		if (x < r + GAP || y < r + GAP || x > lcd_width - r - GAP || y > lcd_heigh - r - GAP)
+			continue;
+
+		if (view.pr[i])
 		{
-			if (strlen(objects[i]->name) * font.FontXsize / 2 > objects[i]->r) continue;
-			font.BackColor = objects[i]->color;
-			font.FontColor = ~objects[i]->color;
-			PrintText(x - strlen(objects[i]->name) * font.FontXsize / 2, y - font.FontYsize / 2, objects[i]->name);
+			//unchanged, redraw only if damaged by others or by the mass center marker
+			int16_t x0 = view.px[i] - r, y0 = view.py[i] - r, x1 = view.px[i] + r + 1, y1 = view.py[i] + r + 1;
+			bool marker = _mass_center.erased && _mass_center.ex + CROSS_SIZE >= x0 && _mass_center.ex - CROSS_SIZE < x1 && \
+				_mass_center.ey + CROSS_SIZE >= y0 && _mass_center.ey - CROSS_SIZE < y1;
+
+			if (!marker && !FrameBufferDamaged(x0, y0, x1, y1))
+				continue;
+
+			x = view.px[i];
+			y = view.py[i];
 		}
+
+		view.px[i] = (int16_t)x;
+		view.py[i] = (int16_t)y;
+		view.pr[i] = r;
+		view.pcolor[i] = s->color[i];
+
+		sprite_draw(view.px[i], view.py[i], r, s->color[i], s->name[i]);
 	}
+
+	FrameBufferFlush(); //tiles are drawn on the workers
+}
+
+/**
+ * Screen position for this frame. Zoom is around the middle of the
+ * screen, which follows the mass center.
+ */
+static void camera_update(double mass_x, double mass_y)
+{
+	screen_center.X = lcd_width / 2 - mass_x;
+	screen_center.Y = lcd_heigh / 2 - mass_y;
+
+	camera.zoom = space_options.zoom;
+	if (camera.zoom == 1)
+	{
+		camera.x0 = screen_center.X;
+		camera.y0 = screen_center.Y;
+		return;
+	}
+
+	camera.x0 = lcd_width / 2 + (screen_center.X - lcd_width / 2) * camera.zoom;
+	camera.y0 = lcd_heigh / 2 + (screen_center.Y - lcd_heigh / 2) * camera.zoom;
+}
+
+/**
+ * Radius on the screen, bodies bigger than UINT16_MAX are off it anyway
+ */
+static uint16_t camera_radius(uint16_t r)
+{
+	return camera.zoom == 1 ? r : (uint16_t)fmin(r * camera.zoom + 0.5, UINT16_MAX);
+}
+
+/**
+ * True if body is drawn as a point
+ */
+static bool camera_splat(uint16_t r)
+{
+	return r * camera.zoom < space_options.splat;
 }
 
-static void border_impact(object_t * object)
+static void border_impact(bodies_t * bodies, uint32_t i)
 {
-	if ((object->x <= (object->r + 5)) || (object->x >= (lcd_width - object->r - 5))) object->vx *= -1;
-	if ((object->y <= (object->r + 5)) || (object->y >= (lcd_heigh - object->r - 5))) object->vy *= -1;
+	uint16_t r = bodies->info[i].r;
+
+	if ((bodies->x[i] <= (r + 5)) || (bodies->x[i] >= (lcd_width - r - 5))) bodies->vx[i] *= -1;
+	if ((bodies->y[i] <= (r + 5)) || (bodies->y[i] >= (lcd_heigh - r - 5))) bodies->vy[i] *= -1;
 }
 
-static object_t * mass_center(object_t ** objects, uint16_t object_s)
+static mass_center_t * mass_center(bodies_t * bodies)
 {
-	const uint8_t cross_size = 10;
-	static object_t _mass_center = { .x = 100,.y = 100,.px = 100,.py = 100,.weight = 0,.isAlive = true,.isMassCenter = true, .color = YELLOW32 };
 
 	//we calculate total mass only once. Total mass should be constant
 	if (_mass_center.weight == 0)
-		for (uint16_t i = 0; i != object_s; i++)
-			_mass_center.weight += objects[i]->weight;
+		for (uint32_t i = 0; i != bodies->size; i++)
+			_mass_center.weight += bodies->m[i];
 
-	_mass_center.x = 0;
-	_mass_center.y = 0;
+	//partial sums over fixed chunks, added in chunk order
+	uint32_t chunks = (bodies->size + MASS_CHUNK - 1) / MASS_CHUNK;
+
+	if (chunks > mass_partial.size)
+	{
+		double * x = realloc(mass_partial.x, sizeof(double) * chunks);
+		if (x) mass_partial.x = x;
+		double * y = realloc(mass_partial.y, sizeof(double) * chunks);
+		if (y) mass_partial.y = y;
 
-	for (uint16_t i = 0; i != object_s; i++)
-		if (objects[i]->isAlive)
+		if (!x || !y) //previous mass center stays
 		{
-			_mass_center.x += objects[i]->x * objects[i]->weight;
-			_mass_center.y += objects[i]->y * objects[i]->weight;
+			printf("Fail to allocate mass center sums\n");
+			run.failed = true;
+			return &_mass_center;
 		}
+		mass_partial.size = chunks;
+	}
+
+	_mass_center.x = 0;
+	_mass_center.y = 0;
+
+	workers_run(mass_center_job, bodies, chunks, 1);
+
+	for (uint32_t c = 0; c != chunks; c++)
+	{
+		_mass_center.x += mass_partial.x[c];
+		_mass_center.y += mass_partial.y[c];
+	}
 
 	_mass_center.x /= _mass_center.weight;
 	_mass_center.y /= _mass_center.weight;
 
-	double x = screen_center.X + _mass_center.x, y = screen_center.Y + _mass_center.y;
+	return &_mass_center;
+}
+
+/**
+ * Marker at the mass center, renderer side of _mass_center
+ */
+static void mass_center_draw(double mass_x, double mass_y)
+{
+	double x = camera.x0 + mass_x * camera.zoom, y = camera.y0 + mass_y * camera.zoom;
+
+	//only when moved to other pixel or something was drawn over it
+	_mass_center.erased = (uint16_t)x != (uint16_t)_mass_center.px || (uint16_t)y != (uint16_t)_mass_center.py;
 
-	DrawCross(_mass_center.px, _mass_center.py, cross_size, lcd_backColor);
-	DrawCross(x, y, cross_size, _mass_center.color);
+	if (_mass_center.erased)
+		DrawCross(_mass_center.px, _mass_center.py, CROSS_SIZE, lcd_backColor);
 
+	if (_mass_center.erased || FrameBufferDamaged(x - CROSS_SIZE, y - CROSS_SIZE, x + CROSS_SIZE + 1, y + CROSS_SIZE + 1))
+		DrawCross(x, y, CROSS_SIZE, _mass_center.color);
+
+	if (_mass_center.erased)
+	{
+		_mass_center.ex = _mass_center.px;
+		_mass_center.ey = _mass_center.py;
+	}
 	_mass_center.px = x;
 	_mass_center.py = y;
+}
 
-	return &_mass_center;
+/**
+ * New statistics once per period. Old text is erased before bodies are
+ * drawn, so bodies under it are drawn again.
+ */
+static void overlay_update(const snapshot_t * s)
+{
+	const uint64_t now = bench_clock();
+	char text[OVERLAY_TEXT];
+	uint32_t alive = 0;
+
+	overlay.changed = false;
+	overlay.frames++;
+	if (overlay.since && now - overlay.since < OVERLAY_PERIOD)
+		return;
+
+	for (uint32_t i = 0; i != s->size; i++)
+		alive += s->alive[i];
+
+	snprintf(text, sizeof(text), "bodies %u\nstep %llu\nfps %.1f\ngravity %s", alive, (unsigned long long)s->step, \
+		overlay.since ? overlay.frames * 1e9 / (now - overlay.since) : 0.0, gravity_names[space_options.gravity]);
+	overlay.since = now;
+	overlay.frames = 0;
+
+	if (!strcmp(text, overlay.text))
+		return;
+
+	DrawFilledRect32(GAP, GAP, GAP + overlay.width, GAP + overlay.height, lcd_backColor);
+	strcpy(overlay.text, text);
+	overlay.changed = true;
+
+	//box of new text
+	uint16_t len = 0;
+	overlay.width = 0;
+	overlay.height = overlay_font.FontYsize;
+	for (const char * c = text; *c; c++)
+	{
+		if (*c != '\n')
+			len++;
+		else
+		{
+			overlay.height += overlay_font.FontYsize;
+			len = 0;
+		}
+		if (len * overlay_font.FontXsize > overlay.width)
+			overlay.width = len * overlay_font.FontXsize;
+	}
 }
 
-static void gravity(object_t * object, object_t * ref_object)
+/**
+ * Text on top of everything drawn in this frame
+ */
+static void overlay_draw(void)
 {
-	if (object == ref_object) return; //object cannot be compared to himself
-	if (!object->isAlive || !ref_object->isAlive) return; //dead object (after impact)
+	if (!overlay.changed && !FrameBufferDamaged(GAP, GAP, GAP + overlay.width, GAP + overlay.height))
+		return;
+
+	SetFont(&overlay_font);
+	PrintText(GAP, GAP, overlay.text);
+	SetFont(&font);
+}
+
+static void mass_center_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const bodies_t * bodies = ctx;
+
+	for (uint32_t c = begin; c != end; c++)
+	{
+		uint32_t last = (c + 1) * MASS_CHUNK < bodies->size ? (c + 1) * MASS_CHUNK : bodies->size;
+		double x = 0, y = 0;
+
+		for (uint32_t i = c * MASS_CHUNK; i != last; i++)
+			if (bodies->alive[i])
+			{
+				x += bodies->x[i] * bodies->m[i];
+				y += bodies->y[i] * bodies->m[i];
+			}
+
+		mass_partial.x[c] = x;
+		mass_partial.y[c] = y;
+	}
+}
+
+static void gravity(bodies_t * bodies, uint32_t i, uint32_t j)
+{
+	if (i == j) return; //object cannot be compared to himself
+	if (!bodies->alive[i] || !bodies->alive[j]) return; //dead object (after impact)
 
 	/* positions */
-	double dx = object->x - ref_object->x;
-	double dy = object->y - ref_object->y;
+	double dx = bodies->x[i] - bodies->x[j];
+	double dy = bodies->y[i] - bodies->y[j];
 
 	/* distance ^2 */
 	double r2 = dx * dx + dy * dy;
 
 	/* gravity law */
-	double a = -G * ref_object->weight / r2;
+	double a = -G * bodies->m[j] / r2;
 	//double a = F / object->weight;
 
 	/* distance */
 	double r = sqrt(r2);
 
 	/* acceleration */
-	object->ax += a * dx / r;
-	object->ay += a * dy / r;
+	bodies->ax[i] += a * dx / r;
+	bodies->ay[i] += a * dy / r;
 }
 
-static void process_impact(object_t * object, object_t * ref_object)
+static void process_impact(bodies_t * bodies, uint32_t i, uint32_t j)
 {
-	if (object == ref_object) return; //object cannot be compared to himself
+	double t;
+
+	if (i == j) return; //object cannot be compared to himself
+
+	if (!bodies->alive[i] || !bodies->alive[j]) return; //dead object (after impact)
+
+	if (check_impact(bodies, i, j, &t)) //impact
+	{
+		uint32_t o1, o2;
+
+		if (bodies->m[i] > bodies->m[j])
+			o1 = i, o2 = j;
+		else
+			o2 = i, o1 = j;
+
+		body_info_t * i1 = &bodies->info[o1], * i2 = &bodies->info[o2];
+		const impact_record_t record = { .step = run.step, .survivor = bodies->id[o1], .absorbed = bodies->id[o2], \
+			.survivor_mass = bodies->m[o1], .absorbed_mass = bodies->m[o2], .x = bodies->x[o1], .y = bodies->y[o1] };
+
+		impacts_record(&record);
+
+		bodies->alive[o2] = false; //kill first object
+		bodies->alive[o1] = true; //second object survive
 
-	if (!object->isAlive || !ref_object->isAlive) return; //dead object (after impact)
+		bodies->vx[o1] = (bodies->vx[o1] * bodies->m[o1] + bodies->vx[o2] * bodies->m[o2])\
+			/ (bodies->m[o1] + bodies->m[o2]);
 
-	if (!ref_object->isMassCenter) //we don't check impact with mass center - it is not a phisical object
-		if (check_impact(object, ref_object)) //impact
+		bodies->vy[o1] = (bodies->vy[o1] * bodies->m[o1] + bodies->vy[o2] * bodies->m[o2])\
+			/ (bodies->m[o1] + bodies->m[o2]);
+
+		bodies->m[o1] += bodies->m[o2]; //add his mass to reference object
+
+		i1->r = sqrt(pow(i2->r, 2) + pow(i1->r, 2)); //and increase size
+
+		i1->color = mix_color(i1->color, i2->color, bodies->m[o1], bodies->m[o2]);
+	}
+}
+
+/**
+ * Broadphase: live bodies are hashed by end of step position into cells
+ * of the largest diameter plus the longest move of both objects, so only
+ * bodies in the same or neighbouring cells can touch during the step.
+ * Impacts are found in parallel, then merged serially in order of impact
+ * time (ties by index). Impacts created by merges of this step are
+ * handled on the next one.
+ */
+static void process_impact_all(bodies_t * bodies)
+{
+	uint16_t r_max = 0;
+	double move_max = 0;
+
+	for (uint32_t i = 0; i != bodies->size; i++)
+		if (bodies->alive[i])
 		{
-			object_t * o1, *o2;
+			double mx = bodies->x[i] - bodies->x0[i], my = bodies->y[i] - bodies->y0[i];
 
-			if (object->weight > ref_object->weight)
-				o1 = object, o2 = ref_object;
-			else
-				o2 = object, o1 = ref_object;
+			if (bodies->info[i].r > r_max) r_max = bodies->info[i].r;
+			move_max = fmax(move_max, mx * mx + my * my);
+		}
+
+	if (!broadphase_build(bodies, 2.0 * (r_max + sqrt(move_max))))
+	{
+		printf("Fail to allocate impact grid\n");
+		run.failed = true;
+		return;
+	}
 
-			o2->isAlive = false; //kill first object
-			o1->isAlive = true; //second object survive
-			o2->fillLastTime = true;
+	for (uint8_t w = 0; w != WORKERS_MAX; w++)
+	{
+		impact.list[w].size = 0;
+		impact.list[w].failed = false;
+	}
 
-			o1->vx = (o1->vx * o1->weight + o2->vx * o2->weight)\
-				/ (o1->weight + o2->weight);
+	workers_run(impact_job, bodies, bodies->size, 256);
 
-			o1->vy = (o1->vy * o1->weight + o2->vy * o2->weight)\
-				/ (o1->weight + o2->weight);
+	uint32_t events = 0;
+	bool failed = false;
 
-			o1->weight += o2->weight; //add his mass to reference object
+	for (uint8_t w = 0; w != WORKERS_MAX; w++)
+	{
+		events += impact.list[w].size;
+		failed |= impact.list[w].failed;
+	}
 
-			o1->r = sqrt(pow(o2->r, 2) + pow(o1->r, 2)); //and increase size
+	if (!failed && events > impact.capacity)
+	{
+		impact_event_t * event = realloc(impact.event, sizeof(impact_event_t) * events);
 
-			o1->color = mix_color(o1->color, o2->color, o1->weight, o2->weight);
+		if (event)
+		{
+			impact.event = event;
+			impact.capacity = events;
+		}
+		else
+			failed = true;
+	}
 
-			printf("Impact between %s and %s\n", o1->name, o2->name);
+	if (failed) //merging only part of them would depend on the thread count
+	{
+		printf("Fail to allocate impact list\n");
+		run.failed = true;
+		return;
+	}
 
-			return;
+	events = 0;
+	for (uint8_t w = 0; w != WORKERS_MAX; w++)
+		if (impact.list[w].size)
+		{
+			memcpy(impact.event + events, impact.list[w].event, sizeof(impact_event_t) * impact.list[w].size);
+			events += impact.list[w].size;
 		}
+
+	if (events)
+		qsort(impact.event, events, sizeof(impact_event_t), compare_impact);
+
+	for (uint32_t e = 0; e != events; e++)
+		process_impact(bodies, impact.event[e].i, impact.event[e].j);
 }
 
-static void process_impact_all(object_t ** object, uint16_t object_s)
+static void impact_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
 {
-	for (uint8_t i = 0; i != object_s; i++)
-		for (uint8_t j = 0; j != object_s; j++)
-			process_impact(object[i], object[j]);
+	impact_walk_t walk = { ctx, worker };
+
+	for (uint32_t i = begin; i != end; i++)
+		broadphase_visit(i, impact_found, &walk);
 }
 
-static void gravity_object_to_object(object_t ** object, uint16_t object_s)
+/**
+ * Each pair is seen from both sides, keep it once (i < j)
+ */
+static bool impact_found(void * ctx, uint32_t i, uint32_t j)
 {
-	for (uint8_t i = 0; i != object_s; i++)
+	const impact_walk_t * walk = ctx;
+	const uint8_t worker = walk->worker;
+	double t;
+
+	if (j < i || !walk->bodies->alive[j] || !check_impact(walk->bodies, i, j, &t))
+		return true;
+
+	if (impact.list[worker].size == impact.list[worker].capacity)
 	{
-		object[i]->ax = 0;
-		object[i]->ay = 0;
+		const uint32_t capacity = impact.list[worker].capacity ? impact.list[worker].capacity * 2 : 64;
+		impact_event_t * event = realloc(impact.list[worker].event, sizeof(impact_event_t) * capacity);
+
+		if (!event)
+		{
+			impact.list[worker].failed = true;
+			return false; //stop visiting, the step will be stopped
+		}
+		impact.list[worker].event = event;
+		impact.list[worker].capacity = capacity;
 	}
 
-	for (uint8_t i = 0; i != object_s; i++)
-		for (uint8_t j = 0; j != object_s; j++)
-			gravity(object[i], object[j]);
+	impact.list[worker].event[impact.list[worker].size++] = (impact_event_t){ t, i, j };
+
+	return true;
 }
 
-static void gravity_oject_to_massCenter(object_t ** object, uint16_t object_s, object_t * massCenter)
+static int compare_impact(const void * a, const void * b)
 {
-	for (uint8_t i = 0; i != object_s; i++)
-		gravity(object[i], massCenter);
+	const impact_event_t * e1 = a, * e2 = b;
+
+	if (e1->t != e2->t) return e1->t < e2->t ? -1 : 1;
+	if (e1->i != e2->i) return e1->i < e2->i ? -1 : 1;
+	return e1->j < e2->j ? -1 : e1->j > e2->j;
+}
+
+static void gravity_object_to_object(bodies_t * bodies, const uint32_t * list, uint32_t list_s)
+{
+	gravity_targets_t targets = { .bodies = bodies, .list = list };
+
+	workers_run(gravity_job, &targets, list ? list_s : bodies->size, 16);
+}
+
+static void gravity_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	gravity_targets_t * targets = ctx;
+	bodies_t * bodies = targets->bodies;
+
+	for (uint32_t k = begin; k != end; k++)
+	{
+		uint32_t i = targets->list ? targets->list[k] : k;
+
+		bodies->ax[i] = 0;
+		bodies->ay[i] = 0;
+
+		for (uint32_t j = 0; j != bodies->size; j++)
+			gravity(bodies, i, j);
+	}
+}
+
+/**
+ * Run gravity engine selected in space_options for bodies in the list,
+ * all of them when list is NULL
+ */
+static void gravity_all(bodies_t * bodies, const uint32_t * list, uint32_t list_s)
+{
+	uint64_t t = bench_clock();
+	const bool done = gravity_engine(bodies, list, list_s);
+
+	bench_lap(BENCH_GRAVITY, t);
+	if (!done)
+	{
+		printf("Fail to allocate gravity engine\n");
+		run.failed = true;
+		return;
+	}
+
+	if (space_options.tolerance && !list)
+	{
+		gravity_check(bodies);
+		space_options.tolerance = 0; //only once, exact gravity is O(N^2)
+	}
+}
+
+/**
+ * Returns false if the engine is out of memory
+ */
+static bool gravity_engine(bodies_t * bodies, const uint32_t * list, uint32_t list_s)
+{
+	switch (space_options.gravity)
+	{
+	case GRAVITY_TREE:
+		return tree_gravity(bodies, space_options.theta, list, list_s);
+	case GRAVITY_PM:
+		return pm_gravity(bodies, space_options.pm_grid, list, list_s);
+	case GRAVITY_SIMD:
+		return simd_gravity(bodies, list, list_s);
+	case GRAVITY_EXACT:
+	default:
+		gravity_object_to_object(bodies, list, list_s);
+		break;
+	}
+	return true;
+}
+
+/**
+ * Compare accelerations of selected engine with exact gravity, on the
+ * bodies and on two probes with a stretched bounding box, where the
+ * edges of engine grids are used.
+ */
+static void gravity_check(bodies_t * bodies)
+{
+	const double error[] = { gravity_error(bodies), gravity_probe(false), gravity_probe(true) };
+	const char * name[] = { "bodies", "x-elongated probe", "y-elongated probe" };
+
+	for (uint8_t c = 0; c != sizeof(error) / sizeof(error[0]); c++)
+		printf("Gravity check, %s: error = %g, tolerance = %g: %s\n", name[c], error[c], space_options.tolerance, \
+			error[c] >= 0 && error[c] <= space_options.tolerance ? "OK" : "FAIL");
+}
+
+/**
+ * Error of accelerations found by the selected engine, relative to the
+ * largest exact acceleration. Accelerations of the engine are kept.
+ * Returns -1 if out of memory.
+ */
+static double gravity_error(bodies_t * bodies)
+{
+	double * ax = malloc(sizeof(double) * bodies->size);
+	double * ay = malloc(sizeof(double) * bodies->size);
+	double max_error = 0, max_a = 0;
+
+	if (!ax || !ay)
+	{
+		free(ax);
+		free(ay);
+		return -1;
+	}
+
+	memcpy(ax, bodies->ax, sizeof(double) * bodies->size);
+	memcpy(ay, bodies->ay, sizeof(double) * bodies->size);
+
+	gravity_object_to_object(bodies, NULL, 0);
+
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		double dx = ax[i] - bodies->ax[i], dy = ay[i] - bodies->ay[i];
+		max_error = fmax(max_error, sqrt(dx * dx + dy * dy));
+		max_a = fmax(max_a, sqrt(bodies->ax[i] * bodies->ax[i] + bodies->ay[i] * bodies->ay[i]));
+	}
+
+	//keep results of selected engine
+	memcpy(bodies->ax, ax, sizeof(double) * bodies->size);
+	memcpy(bodies->ay, ay, sizeof(double) * bodies->size);
+
+	if (max_a) max_error /= max_a;
+
+	free(ax);
+	free(ay);
+
+	return max_error;
+}
+
+/**
+ * Heavy body between two light ones, along y or x, so the bounding box
+ * is a line and the bodies sit on the edges of the engine grid
+ */
+static double gravity_probe(bool vertical)
+{
+	const double at[] = { 0, 100, -100 }, mass[] = { 1000, 1, 1 };
+	bodies_t probe = { 0 };
+
+	if (!bodies_alloc(&probe, 3))
+		return -1;
+
+	for (uint32_t i = 0; i != 3; i++)
+		bodies_set(&probe, i, &(object_t){ .r = 1, .weight = mass[i], .x = vertical ? 0 : at[i], .y = vertical ? at[i] : 0 });
+
+	const double error = gravity_engine(&probe, NULL, 0) ? gravity_error(&probe) : -1;
+
+	bodies_free(&probe);
+	return error;
+}
+
+static void gravity_oject_to_massCenter(bodies_t * bodies, mass_center_t * massCenter)
+{
+	for (uint32_t i = 0; i != bodies->size; i++)
+	{
+		if (!bodies->alive[i])
+			continue;
+
+		double dx = bodies->x[i] - massCenter->x;
+		double dy = bodies->y[i] - massCenter->y;
+		double r2 = dx * dx + dy * dy;
+		double a = -G * massCenter->weight / r2;
+		double r = sqrt(r2);
+
+		bodies->ax[i] += a * dx / r;
+		bodies->ay[i] += a * dy / r;
+	}
 }
 
 static uint32_t mix_color(uint32_t c1, uint32_t c2, double w1, double w2)
 {
 	union
 	{
-		uint8_t r, g, b, a;
+		struct { uint8_t b, g, r, a; }; //0x00RRGGBB in memory
 		uint32_t rgb32;
 	}rgb[3];
 
@@ -430,7 +1600,7 @@ static uint32_t mix_color(uint32_t c1, uint32_t c2, double w1, double w2)
 	rgb[2].r = (rgb[0].r * w1 + rgb[1].r * w2) / (w1 + w2);
 	rgb[2].g = (rgb[0].g * w1 + rgb[1].g * w2) / (w1 + w2);
 	rgb[2].b = (rgb[0].b * w1 + rgb[1].b * w2) / (w1 + w2);
-	rgb[2].a = 0xFF;
+	rgb[2].a = 0;
 
 	return rgb[2].rgb32;
-}
\ No newline at end of file
+}
@@ -0,0 +1,60 @@
+#ifndef SPACE_H
+#define SPACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+#define SPACE_LEVELS_MAX	16 //finest block time step is dt / 2^16
+#define SPACE_FRAME_RATE	60 //frames per second of the renderer on a screen
+
+/* Gravity engines */
+typedef enum
+{
+	GRAVITY_EXACT,	//all pairs, O(N^2)
+	GRAVITY_TREE,	//Barnes-Hut quadtree, O(N log N)
+	GRAVITY_PM,	//particle-mesh, FFT on a grid, O(N + grid^2 log grid)
+	GRAVITY_SIMD,	//all pairs, vector kernel, each pair once, single precision
+}gravity_engine_t;
+
+/* Models of random objects */
+typedef enum
+{
+	MODEL_UNIFORM,	//uniform over the screen, random speeds
+	MODEL_PLUMMER,	//Plummer sphere projected on the plane
+	MODEL_DISK,	//exponential disk on circular orbits
+	MODEL_MERGER,	//two Plummer spheres on collision course
+}model_t;
+
+/* Simulation options, set before space_init() */
+typedef struct
+{
+	gravity_engine_t gravity;
+	double theta; //Barnes-Hut opening angle, 0 = exact
+	uint16_t pm_grid; //particle-mesh grid resolution, power of two
+	double tolerance; //if not 0, compare engine against exact gravity on first step
+	uint32_t reorder; //sort bodies along Morton curve every N steps, 0 = never
+	double dt; //time step
+	uint8_t levels; //block time steps dt / 2^level, level 0..levels, 0 = one step for all
+	double eta; //accuracy of block time steps, step = eta * sqrt(r / |a|)
+	uint32_t seed; //random objects
+	model_t model; //of random objects
+	uint64_t steps; //stop after N steps, 0 = run forever
+	const char * bench; //file for benchmark results, NULL = no benchmark
+	bool overlay; //statistics in the top left corner
+	double zoom; //screen pixels per unit of space, around the mass center
+	double splat; //bodies with radius below it in pixels are splatted as points
+	double rate; //steps per second on a screen, 0 = as fast as possible
+	const char * checkpoint; //file to save the state to when the run stops, NULL = none
+	const char * resume; //checkpoint to start from instead of new objects, NULL = none
+	const char * scenario; //file with initial conditions instead of random objects, NULL = none
+	const char * trajectory; //"file[:every][:raw|float|delta][:drop]" to record bodies, NULL = none
+	const char * impacts; //file for merges as CSV, NULL = none
+}space_options_t;
+
+extern space_options_t space_options;
+extern const double G;
+
+bool space_init(uint32_t objects_s, uint32_t backColor);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "splat.h"
+#include "framebuffer.h"
+#include "workers.h"
+
+/*
+ * Level of detail for bodies smaller than a pixel. Instead of drawing
+ * circles, bodies are splatted into per pixel sums of mass and mass
+ * weighted color, then each touched pixel gets the mean color, brighter
+ * with more mass (log scale against the heaviest pixel). Screen points
+ * of all bodies are computed in parallel, sums are made serially in body
+ * order, so the image does not depend on thread count. Work after the
+ * first pass grows with touched pixels, not with bodies.
+ *
+ * Points are packed as y << 16 | x. Pixels of the last frame are kept,
+ * they are erased before the next one is drawn.
+ */
+static struct
+{
+	uint16_t width, height;
+	float * mass, * red, * green, * blue; //sums per pixel, zero outside of a frame
+	uint32_t * touched, * color; //points with mass and their color
+	uint32_t touched_s;
+	uint32_t * point; //point of each body, SPLAT_NONE if not splatted
+	uint32_t capacity;
+
+	//current call
+	const snapshot_t * s;
+	const double * x, * y;
+	double r_max;
+}splat;
+
+/* Functions */
+static bool buffers(void);
+static void point_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Screen size, pixel buffers are allocated when a body is splatted first
+ */
+void splat_init(uint16_t width, uint16_t height)
+{
+	splat_free();
+	splat.width = width;
+	splat.height = height;
+}
+
+/**
+ * Remove pixels of the last frame
+ */
+void splat_erase(uint32_t backColor)
+{
+	FillPoints32(splat.touched, splat.touched_s, backColor);
+	splat.touched_s = 0;
+}
+
+/**
+ * Splat live bodies with radius below limit pixels, x and y are screen
+ * positions of bodies, zoom is pixels per unit of radius. Returns amount
+ * of splatted bodies.
+ */
+uint32_t splat_draw(const snapshot_t * s, const double * x, const double * y, double zoom, double limit)
+{
+	uint32_t splatted = 0;
+
+	if (!splat.width)
+		return 0;
+
+	if (s->size > splat.capacity)
+	{
+		free(splat.point);
+		splat.capacity = s->size;
+		splat.point = malloc(sizeof(uint32_t) * splat.capacity);
+		if (!splat.point)
+		{
+			splat.capacity = 0;
+			return 0;
+		}
+	}
+
+	splat.s = s;
+	splat.x = x;
+	splat.y = y;
+	splat.r_max = limit / zoom;
+	workers_run(point_job, 0, s->size, 0);
+
+	//sums in body order
+	for (uint32_t i = 0; i != s->size; i++)
+	{
+		const uint32_t p = splat.point[i];
+
+		if (p == SPLAT_NONE || (!splat.mass && !buffers()))
+			continue;
+
+		const size_t k = (size_t)(p >> 16) * splat.width + (p & 0xFFFF);
+		const uint32_t c = s->color[i];
+		const float m = s->m[i];
+
+		if (splat.mass[k] == 0)
+			splat.touched[splat.touched_s++] = p;
+		splat.mass[k] += m;
+		splat.red[k] += m * (c >> 16 & 0xFF);
+		splat.green[k] += m * (c >> 8 & 0xFF);
+		splat.blue[k] += m * (c & 0xFF);
+		splatted++;
+	}
+
+	float mass_max = 0;
+	for (uint32_t t = 0; t != splat.touched_s; t++)
+	{
+		const uint32_t p = splat.touched[t];
+		const float m = splat.mass[(size_t)(p >> 16) * splat.width + (p & 0xFFFF)];
+
+		if (m > mass_max)
+			mass_max = m;
+	}
+
+	//tone map, heaviest pixel keeps the color, others fade down to 1/4
+	const float scale = 0.75f / log1pf(mass_max);
+	for (uint32_t t = 0; t != splat.touched_s; t++)
+	{
+		const uint32_t p = splat.touched[t];
+		const size_t k = (size_t)(p >> 16) * splat.width + (p & 0xFFFF);
+		const float b = (0.25f + log1pf(splat.mass[k]) * scale) / splat.mass[k];
+
+		splat.color[t] = (uint32_t)(splat.red[k] * b) << 16 | (uint32_t)(splat.green[k] * b) << 8 | (uint32_t)(splat.blue[k] * b);
+		splat.mass[k] = splat.red[k] = splat.green[k] = splat.blue[k] = 0;
+	}
+
+	DrawPoints32(splat.touched, splat.color, splat.touched_s);
+
+	return splatted;
+}
+
+void splat_free(void)
+{
+	free(splat.mass);
+	free(splat.red);
+	free(splat.green);
+	free(splat.blue);
+	free(splat.touched);
+	free(splat.color);
+	free(splat.point);
+	memset(&splat, 0, sizeof(splat));
+}
+
+/**
+ * Sums and points of the whole screen, false if there is no memory
+ */
+static bool buffers(void)
+{
+	const size_t pixels = (size_t)splat.width * splat.height;
+
+	if (!pixels)
+		return false;
+
+	splat.mass = calloc(pixels, sizeof(float));
+	splat.red = calloc(pixels, sizeof(float));
+	splat.green = calloc(pixels, sizeof(float));
+	splat.blue = calloc(pixels, sizeof(float));
+	splat.touched = malloc(sizeof(uint32_t) * pixels);
+	splat.color = malloc(sizeof(uint32_t) * pixels);
+
+	if (!splat.mass || !splat.red || !splat.green || !splat.blue || !splat.touched || !splat.color)
+	{
+		free(splat.mass);
+		free(splat.red);
+		free(splat.green);
+		free(splat.blue);
+		free(splat.touched);
+		free(splat.color);
+		splat.mass = splat.red = splat.green = splat.blue = 0;
+		splat.touched = splat.color = 0;
+		splat.width = 0; //no more tries
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Screen point of bodies, SPLAT_NONE for dead, big or outside
+ */
+static void point_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const snapshot_t * s = splat.s;
+
+	for (uint32_t i = begin; i != end; i++)
+	{
+		const double x = splat.x[i], y = splat.y[i];
+
+		splat.point[i] = SPLAT_NONE;
+		if (!s->alive[i] || s->r[i] >= splat.r_max || \
+			!(x >= 0 && x < splat.width && y >= 0 && y < splat.height))
+			continue;
+
+		splat.point[i] = (uint32_t)y << 16 | (uint32_t)x;
+	}
+}
@@ -0,0 +1,15 @@
+#ifndef SPLAT_H
+#define SPLAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "snapshot.h"
+
+#define SPLAT_NONE		UINT32_MAX //body is not splatted
+
+void splat_init(uint16_t width, uint16_t height);
+void splat_erase(uint32_t backColor);
+uint32_t splat_draw(const snapshot_t * s, const double * x, const double * y, double zoom, double limit);
+void splat_free(void);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sprite.h"
+#include "bodies.h"
+
+#define SPRITE_BUCKETS		4096 //hash buckets, power of two
+
+/*
+ * Cache of bodies rendered once into own bitmaps. Key is radius, color
+ * and label, so a body is drawn by one copy per row until a merge changes
+ * it. Entries are in an LRU list, the least recently used ones are freed
+ * when the cache gets over its size.
+ *
+ * Copy reads memory, fill does not, so circles above SPRITE_RADIUS_MAX
+ * are filled with spans and only their label comes from the cache (entry
+ * with radius 0). Sprites bigger than 1/8 of the cache are not kept,
+ * such bodies are drawn directly.
+ */
+typedef struct sprite_entry
+{
+	sprite_t sprite;
+	uint32_t color, hash;
+	uint16_t r;
+	char label[BODY_NAME_SIZE];
+	size_t size; //bytes of this entry
+	struct sprite_entry * prev, * next; //LRU list, head is the most recent
+	struct sprite_entry * chain; //next in the same bucket
+}sprite_entry_t;
+
+static struct
+{
+	sprite_entry_t ** bucket;
+	sprite_entry_t * head, * tail;
+	size_t size, used; //limit and bytes in use
+	Font_StructTypeDef * font;
+}cache;
+
+/* Functions */
+static const char * shown(const char * label, uint16_t r);
+static uint32_t hash(uint16_t r, uint32_t color, const char * label);
+static sprite_entry_t ** find(uint16_t r, uint32_t color, const char * label, uint32_t h);
+static const sprite_t * get(uint16_t r, uint32_t color, const char * label);
+static sprite_entry_t * render(uint16_t r, uint32_t color, const char * label, uint32_t h);
+static void unlink_entry(sprite_entry_t * e);
+static void drop(sprite_entry_t ** link);
+
+/**
+ * Cache up to size bytes of sprites, 0 = no cache. Labels use font.
+ */
+void sprite_init(size_t size, Font_StructTypeDef * font)
+{
+	sprite_free();
+
+	cache.font = font;
+	cache.size = size;
+	if (size)
+		cache.bucket = calloc(SPRITE_BUCKETS, sizeof(sprite_entry_t *));
+}
+
+/**
+ * Sprite of a body, rendered on first use. NULL if there is no cache
+ * or the circle is too big for it.
+ */
+const sprite_t * sprite_get(uint16_t r, uint32_t color, const char * label)
+{
+	if (!cache.bucket || r > SPRITE_RADIUS_MAX)
+		return 0;
+
+	return get(r, color, shown(label, r));
+}
+
+/**
+ * Draw body centered at x, y: filled circle and label if it fits
+ */
+void sprite_draw(int16_t x, int16_t y, uint16_t r, uint32_t color, const char * label)
+{
+	const sprite_t * s = sprite_get(r, color, label);
+
+	if (!s)
+	{
+		DrawFilledCircle32(x, y, r, color);
+
+		label = shown(label, r);
+		if (!label[0])
+			return;
+		if (!cache.bucket || !(s = get(0, color, label)))
+		{
+			cache.font->BackColor = color;
+			cache.font->FontColor = ~color;
+			PrintText(x - strlen(label) * cache.font->FontXsize / 2, y - cache.font->FontYsize / 2, label);
+			return;
+		}
+	}
+
+	DrawMasked32(x + s->ox, y + s->oy, s->width, s->height, s->pixels, s->span);
+}
+
+/**
+ * Forget sprites of a body which is changed or gone
+ */
+void sprite_drop(uint16_t r, uint32_t color, const char * label)
+{
+	if (!cache.bucket)
+		return;
+
+	label = shown(label, r);
+
+	sprite_entry_t ** link = find(r, color, label, hash(r, color, label));
+	if (*link)
+		drop(link);
+
+	if (label[0] && r > SPRITE_RADIUS_MAX && *(link = find(0, color, label, hash(0, color, label))))
+		drop(link);
+}
+
+void sprite_free(void)
+{
+	while (cache.tail)
+	{
+		sprite_entry_t * e = cache.tail;
+		drop(find(e->r, e->color, e->label, e->hash));
+	}
+
+	free(cache.bucket);
+	cache.bucket = 0;
+	cache.used = 0;
+}
+
+/**
+ * Label is drawn only when it is not wider than the circle
+ */
+static const char * shown(const char * label, uint16_t r)
+{
+	if (!label || !label[0] || strlen(label) * cache.font->FontXsize / 2 > r)
+		return "";
+	return label;
+}
+
+/**
+ * Cached sprite, LRU entries are freed to make room for a new one
+ */
+static const sprite_t * get(uint16_t r, uint32_t color, const char * label)
+{
+	uint32_t h = hash(r, color, label);
+	sprite_entry_t ** link = find(r, color, label, h), * e = *link;
+
+	if (e)
+		unlink_entry(e);
+	else if (!(e = render(r, color, label, h)))
+		return 0;
+
+	//most recent
+	e->prev = 0;
+	e->next = cache.head;
+	if (cache.head)
+		cache.head->prev = e;
+	cache.head = e;
+	if (!cache.tail)
+		cache.tail = e;
+
+	return &e->sprite;
+}
+
+/**
+ * FNV-1a of the key
+ */
+static uint32_t hash(uint16_t r, uint32_t color, const char * label)
+{
+	uint32_t h = 2166136261u;
+
+	h = (h ^ r) * 16777619u;
+	h = (h ^ color) * 16777619u;
+	for (; *label; label++)
+		h = (h ^ (uint8_t)*label) * 16777619u;
+
+	return h;
+}
+
+/**
+ * Link to the entry with this key, or to the end of its bucket
+ */
+static sprite_entry_t ** find(uint16_t r, uint32_t color, const char * label, uint32_t h)
+{
+	sprite_entry_t ** link = &cache.bucket[h & (SPRITE_BUCKETS - 1)];
+
+	for (; *link; link = &(*link)->chain)
+		if ((*link)->hash == h && (*link)->r == r && (*link)->color == color && !strcmp((*link)->label, label))
+			break;
+
+	return link;
+}
+
+/**
+ * New entry with circle of DrawFilledCircle32() and label of PrintText(),
+ * LRU entries are freed to make room
+ */
+static sprite_entry_t * render(uint16_t r, uint32_t color, const char * label, uint32_t h)
+{
+	const Font_StructTypeDef * font = cache.font;
+	const int32_t len = strlen(label);
+	const int32_t lx = -len * font->FontXsize / 2, ly = -font->FontYsize / 2;
+	int32_t x0 = -r, y0 = -r, x1 = r, y1 = r + 1;
+
+	if (len)
+	{
+		if (lx < x0) x0 = lx;
+		if (ly < y0) y0 = ly;
+		if (lx + len * font->FontXsize > x1) x1 = lx + len * font->FontXsize;
+		if (ly + font->FontYsize > y1) y1 = ly + font->FontYsize;
+	}
+
+	const size_t size = sizeof(sprite_entry_t) + sizeof(uint16_t) * 2 * (y1 - y0) + sizeof(uint32_t) * (x1 - x0) * (y1 - y0);
+
+	if (size > cache.size / 8)
+		return 0;
+
+	const uint16_t width = x1 - x0, height = y1 - y0;
+
+	while (cache.tail && cache.used + size > cache.size)
+		drop(find(cache.tail->r, cache.tail->color, cache.tail->label, cache.tail->hash));
+
+	sprite_entry_t * e = malloc(size);
+	if (!e)
+		return 0;
+
+	uint32_t * pixels = (uint32_t *)(e + 1);
+	uint16_t * span = (uint16_t *)(pixels + width * height);
+
+	for (uint16_t y = 0; y != height; y++)
+	{
+		span[2 * y] = width;
+		span[2 * y + 1] = 0;
+	}
+
+	//rows of the circle, widest span of each y
+	int32_t x = -r, y = 0, err = 2 - 2 * r, e2, last = -1;
+	do {
+		if (y != last)
+		{
+			for (int8_t side = y ? -1 : 1; side <= 1; side += 2)
+			{
+				const int32_t row = side * y - y0, b = x - x0, end = -x - x0;
+
+				for (int32_t i = b; i < end; i++)
+					pixels[i + width * row] = color;
+				if (b < end)
+				{
+					if (b < span[2 * row]) span[2 * row] = b;
+					if (end > span[2 * row + 1]) span[2 * row + 1] = end;
+				}
+			}
+			last = y;
+		}
+		e2 = err;
+		if (e2 <= y) {
+			err += ++y * 2 + 1;
+			if (-x == y && e2 <= x) e2 = 0;
+		}
+		if (e2 > x) err += ++x * 2 + 1;
+	} while (x <= 0);
+
+	//label, same pixel order as PrintChar()
+	for (int32_t c = 0; c != len; c++)
+	{
+		const uint8_t * glyph = font->Font + ((uint8_t)label[c] & 0x7F) * font->FontXsize; //128 glyphs, as PrintChar()
+		const int32_t cx = lx + c * font->FontXsize - x0;
+
+		for (uint16_t k = 0; k != font->FontXsize * font->FontYsize; k++)
+		{
+			const int32_t px = cx + k % font->FontXsize, py = ly + k / font->FontXsize - y0;
+
+			pixels[px + width * py] = (glyph[k / font->FontYsize] & (1 << (k % font->FontYsize))) ? ~color : color;
+		}
+		for (uint8_t row = 0; row != font->FontYsize; row++)
+		{
+			uint16_t * s = span + 2 * (ly + row - y0);
+
+			if (cx < s[0]) s[0] = cx;
+			if (cx + font->FontXsize > s[1]) s[1] = cx + font->FontXsize;
+		}
+	}
+
+	for (uint16_t y = 0; y != height; y++)
+		if (span[2 * y] > span[2 * y + 1])
+			span[2 * y] = span[2 * y + 1] = 0;
+
+	e->sprite = (sprite_t){ x0, y0, width, height, span, pixels };
+	e->r = r;
+	e->color = color;
+	e->hash = h;
+	strncpy(e->label, label, BODY_NAME_SIZE - 1);
+	e->label[BODY_NAME_SIZE - 1] = 0;
+	e->size = size;
+	e->chain = 0;
+	*find(r, color, label, h) = e;
+	cache.used += size;
+
+	return e;
+}
+
+static void unlink_entry(sprite_entry_t * e)
+{
+	if (e->prev) e->prev->next = e->next;
+	else cache.head = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else cache.tail = e->prev;
+}
+
+/**
+ * Free entry, link points to it in its bucket
+ */
+static void drop(sprite_entry_t ** link)
+{
+	sprite_entry_t * e = *link;
+
+	FrameBufferFlush(); //recorded frame may still read it
+
+	*link = e->chain;
+	unlink_entry(e);
+	cache.used -= e->size;
+	free(e);
+}
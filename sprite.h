@@ -0,0 +1,26 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "framebuffer.h"
+
+#define SPRITE_CACHE_SIZE	(16 << 20) //bytes of cached sprites
+#define SPRITE_RADIUS_MAX	32 //bigger circles are filled, copy of them is slower
+
+/* Pre-rendered body: filled circle with its label */
+typedef struct
+{
+	int16_t ox, oy; //top left corner relative to body center
+	uint16_t width, height;
+	const uint16_t * span; //opaque pixels of row y are [span[2 * y], span[2 * y + 1])
+	const uint32_t * pixels;
+}sprite_t;
+
+void sprite_init(size_t size, Font_StructTypeDef * font);
+const sprite_t * sprite_get(uint16_t r, uint32_t color, const char * label);
+void sprite_draw(int16_t x, int16_t y, uint16_t r, uint32_t color, const char * label);
+void sprite_drop(uint16_t r, uint32_t color, const char * label);
+void sprite_free(void);
+
+#endif
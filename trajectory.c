@@ -0,0 +1,410 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "trajectory.h"
+#include "workers.h"
+
+#define TRAJECTORY_MAGIC	"PSTRAJ\r\n"
+#define TRAJECTORY_BUFFER	(4u << 20) //bytes per write to the file
+#define TRAJECTORY_FIELDS	5 //x, y, vx, vy, m
+#define TRAJECTORY_LIMIT	(INT64_C(1) << 61) //quanta, beyond (or NaN) is clamped, differences fit int64
+
+/*
+ * File: header, then frames of step u64, count u32, bytes u32 and bytes
+ * of payload, all little-endian. Bodies are in id order, only alive ones.
+ * raw, float: id u32[count], then x, y, vx, vy, m arrays[count] of double
+ * or float. delta: for each body varint of id difference to the previous
+ * body (the first one to -1), then the five fields quantized to
+ * TRAJECTORY_QUANTUM as zigzag varints of the difference to the same id
+ * in the previous frame (0 if it was not there). Values beyond 2^61
+ * quanta (and NaN) are clamped to +-2^61.
+ */
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t encoding;
+	double quantum;
+	uint32_t every; //steps between frames
+	uint32_t capacity; //ids
+}trajectory_header_t;
+
+/* State of all ids after a step, as the simulation copied it */
+typedef struct
+{
+	uint64_t step;
+	double * field[TRAJECTORY_FIELDS]; //by id
+	uint8_t * alive;
+}frame_t;
+
+/*
+ * The simulation only copies fields into a free frame of the ring, on the
+ * workers. Compaction, encoding and writes are done by own thread, so
+ * the simulation never waits for the disk. With a full ring it either
+ * waits for a frame to be written (backpressure) or drops the new one.
+ */
+static struct
+{
+	FILE * out;
+	trajectory_encoding_t encoding;
+	uint32_t every, capacity;
+	bool drop; //drop frames on full ring, otherwise wait
+
+	frame_t * frame;
+	uint32_t frames, head, tail, count; //ring
+	void * arena;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled, emptied;
+	bool quit, open;
+
+	//writer side
+	uint8_t * buffer;
+	size_t buffer_size;
+	int64_t * previous[TRAJECTORY_FIELDS]; //delta encoding, by id
+	uint64_t written, dropped, bytes;
+
+	//current copy
+	const bodies_t * bodies;
+	frame_t * current;
+}trajectory = { .lock = PTHREAD_MUTEX_INITIALIZER, .filled = PTHREAD_COND_INITIALIZER, .emptied = PTHREAD_COND_INITIALIZER };
+
+/* Functions */
+static void * writer_thread(void * arg);
+static size_t encode(const frame_t * frame);
+static uint8_t * reserve(size_t size);
+static uint8_t * varint(uint8_t * p, uint64_t value);
+static void copy_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+/**
+ * Start recording to "file[:every][:raw|float|delta][:drop]", every
+ * N steps (default 1), bodies of capacity ids. Returns "OK" or error.
+ */
+const char * trajectory_open(const char * spec, uint32_t capacity)
+{
+	char file[4096], * token, * next;
+
+	trajectory_close(NULL, NULL, NULL);
+
+	trajectory.every = 1;
+	trajectory.encoding = TRAJECTORY_RAW;
+	trajectory.drop = false;
+	trajectory.capacity = capacity;
+
+	snprintf(file, sizeof(file), "%s", spec);
+	if ((token = strchr(file, ':')))
+		*token++ = 0;
+
+	for (; token; token = next)
+	{
+		if ((next = strchr(token, ':')))
+			*next++ = 0;
+
+		if (!strcmp(token, "raw"))
+			trajectory.encoding = TRAJECTORY_RAW;
+		else if (!strcmp(token, "float"))
+			trajectory.encoding = TRAJECTORY_FLOAT;
+		else if (!strcmp(token, "delta"))
+			trajectory.encoding = TRAJECTORY_DELTA;
+		else if (!strcmp(token, "drop"))
+			trajectory.drop = true;
+		else if (atoi(token) > 0)
+			trajectory.every = atoi(token);
+		else
+			return "Unknown trajectory option!";
+	}
+
+	//ring of whole frames, at least two so copying and writing overlap; alive
+	//bytes are padded to a double, so fields of the next frame stay aligned
+	const size_t alive_size = ((size_t)capacity + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+	const size_t frame_size = sizeof(double) * TRAJECTORY_FIELDS * (size_t)capacity + alive_size;
+	trajectory.frames = frame_size && TRAJECTORY_RING_BYTES / frame_size > 2 ? TRAJECTORY_RING_BYTES / frame_size : 2;
+	trajectory.frame = calloc(trajectory.frames, sizeof(frame_t));
+	trajectory.arena = malloc(frame_size * trajectory.frames + 1);
+
+	bool ready = trajectory.frame && trajectory.arena;
+
+	for (uint8_t f = 0; f != TRAJECTORY_FIELDS && trajectory.encoding == TRAJECTORY_DELTA; f++)
+		ready &= (trajectory.previous[f] = calloc(capacity + 1, sizeof(int64_t))) != NULL;
+
+	if (!ready)
+	{
+		trajectory_close(NULL, NULL, NULL);
+		return "Fail to allocate trajectory ring!";
+	}
+
+	uint8_t * arena = trajectory.arena;
+	for (uint32_t i = 0; i != trajectory.frames; i++)
+	{
+		for (uint8_t f = 0; f != TRAJECTORY_FIELDS; f++, arena += sizeof(double) * capacity)
+			trajectory.frame[i].field[f] = (double *)arena;
+		trajectory.frame[i].alive = arena;
+		arena += alive_size;
+	}
+
+	if (!(trajectory.out = fopen(file, "wb")))
+	{
+		trajectory_close(NULL, NULL, NULL);
+		return "Fail to open trajectory file!";
+	}
+	setvbuf(trajectory.out, NULL, _IOFBF, TRAJECTORY_BUFFER);
+
+	trajectory_header_t header = { .version = TRAJECTORY_VERSION, .encoding = trajectory.encoding, \
+		.quantum = TRAJECTORY_QUANTUM, .every = trajectory.every, .capacity = capacity };
+	memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, trajectory.out);
+	trajectory.bytes = sizeof(header);
+
+	trajectory.head = trajectory.tail = trajectory.count = 0;
+	trajectory.written = trajectory.dropped = 0;
+	trajectory.quit = false;
+	if (pthread_create(&trajectory.thread, NULL, writer_thread, NULL))
+	{
+		trajectory_close(NULL, NULL, NULL);
+		return "Fail to start trajectory writer!";
+	}
+	trajectory.open = true;
+
+	return "OK";
+}
+
+/**
+ * Bodies after step go to the ring if step is one of every N
+ */
+void trajectory_record(const bodies_t * bodies, uint64_t step)
+{
+	if (!trajectory.open || step % trajectory.every)
+		return;
+
+	pthread_mutex_lock(&trajectory.lock);
+	while (trajectory.count == trajectory.frames && !trajectory.drop)
+		pthread_cond_wait(&trajectory.emptied, &trajectory.lock);
+	const bool full = trajectory.count == trajectory.frames;
+	pthread_mutex_unlock(&trajectory.lock);
+
+	if (full)
+	{
+		__atomic_add_fetch(&trajectory.dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	//head frame is not in the ring yet, the writer does not touch it
+	trajectory.bodies = bodies;
+	trajectory.current = &trajectory.frame[trajectory.head];
+	trajectory.current->step = step;
+	workers_run(copy_job, 0, trajectory.capacity, 0);
+
+	pthread_mutex_lock(&trajectory.lock);
+	trajectory.head = (trajectory.head + 1) % trajectory.frames;
+	trajectory.count++;
+	pthread_cond_signal(&trajectory.filled);
+	pthread_mutex_unlock(&trajectory.lock);
+}
+
+/**
+ * Write what is left in the ring and close the file. Counts of frames
+ * written, dropped and file size can be NULL.
+ */
+void trajectory_close(uint64_t * frames, uint64_t * dropped, uint64_t * bytes)
+{
+	if (trajectory.open)
+	{
+		pthread_mutex_lock(&trajectory.lock);
+		trajectory.quit = true;
+		pthread_cond_signal(&trajectory.filled);
+		pthread_mutex_unlock(&trajectory.lock);
+		pthread_join(trajectory.thread, NULL);
+		trajectory.open = false;
+	}
+
+	if (trajectory.out)
+		fclose(trajectory.out);
+	trajectory.out = NULL;
+
+	if (frames) *frames = trajectory.written;
+	if (dropped) *dropped = trajectory.dropped;
+	if (bytes) *bytes = trajectory.bytes;
+
+	for (uint8_t f = 0; f != TRAJECTORY_FIELDS; f++)
+	{
+		free(trajectory.previous[f]);
+		trajectory.previous[f] = NULL;
+	}
+	free(trajectory.frame);
+	free(trajectory.arena);
+	free(trajectory.buffer);
+	trajectory.frame = NULL;
+	trajectory.arena = NULL;
+	trajectory.buffer = NULL;
+	trajectory.buffer_size = 0;
+}
+
+/**
+ * Drains the ring until closed, one frame at a time
+ */
+static void * writer_thread(void * arg)
+{
+	while (1)
+	{
+		pthread_mutex_lock(&trajectory.lock);
+		while (!trajectory.count && !trajectory.quit)
+			pthread_cond_wait(&trajectory.filled, &trajectory.lock);
+		if (!trajectory.count)
+		{
+			pthread_mutex_unlock(&trajectory.lock);
+			break;
+		}
+		const frame_t * frame = &trajectory.frame[trajectory.tail];
+		pthread_mutex_unlock(&trajectory.lock);
+
+		const size_t size = encode(frame);
+		if (size)
+		{
+			fwrite(trajectory.buffer, 1, size, trajectory.out);
+			trajectory.bytes += size;
+			trajectory.written++;
+		}
+		else
+			__atomic_add_fetch(&trajectory.dropped, 1, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&trajectory.lock);
+		trajectory.tail = (trajectory.tail + 1) % trajectory.frames;
+		trajectory.count--;
+		pthread_cond_signal(&trajectory.emptied);
+		pthread_mutex_unlock(&trajectory.lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Frame with its header into the buffer, returns bytes, 0 when out of memory
+ */
+static size_t encode(const frame_t * frame)
+{
+	const uint32_t capacity = trajectory.capacity;
+	const size_t head = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+	uint32_t count = 0;
+
+	for (uint32_t id = 0; id != capacity; id++)
+		count += frame->alive[id];
+
+	const size_t item = trajectory.encoding == TRAJECTORY_DELTA ? 10 * (1 + TRAJECTORY_FIELDS) : \
+		sizeof(uint32_t) + TRAJECTORY_FIELDS * (trajectory.encoding == TRAJECTORY_FLOAT ? sizeof(float) : sizeof(double));
+	uint8_t * p = reserve(head + item * count), * payload = p + head;
+
+	if (!p)
+		return 0;
+
+	if (trajectory.encoding == TRAJECTORY_DELTA)
+	{
+		int64_t last = -1;
+
+		p = payload;
+		for (uint32_t id = 0; id != capacity; id++)
+		{
+			if (!frame->alive[id])
+				continue; //merged ids never come back, their previous values are not used again
+
+			p = varint(p, id - last - 1);
+			last = id;
+
+			for (uint8_t f = 0; f != TRAJECTORY_FIELDS; f++)
+			{
+				const double v = frame->field[f][id] / TRAJECTORY_QUANTUM;
+				const int64_t q = fabs(v) < TRAJECTORY_LIMIT ? llround(v) : v > 0 ? TRAJECTORY_LIMIT : -TRAJECTORY_LIMIT;
+				const int64_t d = q - trajectory.previous[f][id];
+
+				p = varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+				trajectory.previous[f][id] = q;
+			}
+		}
+	}
+	else
+	{
+		uint32_t * id_out = (uint32_t *)payload;
+		uint32_t k = 0;
+
+		for (uint32_t id = 0; id != capacity; id++)
+			if (frame->alive[id])
+				id_out[k++] = id;
+
+		p = payload + sizeof(uint32_t) * count;
+		for (uint8_t f = 0; f != TRAJECTORY_FIELDS; f++)
+			for (k = 0; k != count; k++)
+			{
+				const double v = frame->field[f][id_out[k]];
+
+				if (trajectory.encoding == TRAJECTORY_FLOAT)
+				{
+					const float s = v;
+					memcpy(p, &s, sizeof(s));
+					p += sizeof(s);
+				}
+				else
+				{
+					memcpy(p, &v, sizeof(v));
+					p += sizeof(v);
+				}
+			}
+	}
+
+	const uint32_t bytes = p - payload;
+	memcpy(trajectory.buffer, &frame->step, sizeof(uint64_t));
+	memcpy(trajectory.buffer + sizeof(uint64_t), &count, sizeof(uint32_t));
+	memcpy(trajectory.buffer + sizeof(uint64_t) + sizeof(uint32_t), &bytes, sizeof(uint32_t));
+
+	return head + bytes;
+}
+
+/**
+ * Encode buffer of at least size bytes
+ */
+static uint8_t * reserve(size_t size)
+{
+	if (size > trajectory.buffer_size)
+	{
+		free(trajectory.buffer);
+		trajectory.buffer = malloc(size);
+		trajectory.buffer_size = trajectory.buffer ? size : 0;
+	}
+	return trajectory.buffer;
+}
+
+static uint8_t * varint(uint8_t * p, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		*p++ = value | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+static void copy_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	const bodies_t * bodies = trajectory.bodies;
+	frame_t * frame = trajectory.current;
+
+	for (uint32_t id = begin; id != end; id++)
+	{
+		const uint32_t i = bodies->slot[id];
+
+		if (i == BODIES_NONE || !bodies->alive[i])
+		{
+			frame->alive[id] = 0;
+			continue;
+		}
+
+		frame->field[0][id] = bodies->x[i];
+		frame->field[1][id] = bodies->y[i];
+		frame->field[2][id] = bodies->vx[i];
+		frame->field[3][id] = bodies->vy[i];
+		frame->field[4][id] = bodies->m[i];
+		frame->alive[id] = 1;
+	}
+}
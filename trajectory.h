@@ -0,0 +1,24 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bodies.h"
+
+#define TRAJECTORY_VERSION	1
+#define TRAJECTORY_RING_BYTES	(64u << 20) //frames waiting for the writer, at least 2
+#define TRAJECTORY_QUANTUM	(1.0 / 1024) //unit of delta encoded values
+
+/* How frames are stored in the file */
+typedef enum
+{
+	TRAJECTORY_RAW, //double
+	TRAJECTORY_FLOAT, //single precision
+	TRAJECTORY_DELTA, //quantized, varint difference to the previous frame
+}trajectory_encoding_t;
+
+const char * trajectory_open(const char * spec, uint32_t capacity);
+void trajectory_record(const bodies_t * bodies, uint64_t step);
+void trajectory_close(uint64_t * frames, uint64_t * dropped, uint64_t * bytes);
+
+#endif
@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tree.h"
+#include "workers.h"
+
+#define TREE_MAX_DEPTH		48 //deeper than that bodies are chained in one leaf
+#define TREE_NONE		-1
+#define TREE_STACK		(4 * TREE_MAX_DEPTH + 4)
+
+/* Quadtree node */
+typedef struct
+{
+	double cx, cy, half; //cell center and half size
+	double mass, mx, my; //total mass and center of mass
+	int32_t child[4];
+	int32_t body; //first body of a leaf, TREE_NONE for internal or empty node
+	uint8_t depth;
+}node_t;
+
+/* Live bodies packed for the current step */
+static struct
+{
+	double * x, * y, * m;
+	int32_t * next; //next body in the same leaf
+	uint32_t * index; //position in body store
+	uint32_t size, capacity;
+}bodies;
+
+static bodies_t * store;
+static const uint32_t * targets; //store indexes to evaluate, NULL = all
+
+static struct
+{
+	node_t * node;
+	uint32_t size, capacity;
+}tree;
+
+/* Functions */
+static bool pack_bodies(bodies_t * store);
+static int32_t new_node(double cx, double cy, double half, uint8_t depth);
+static uint8_t quadrant(const node_t * node, double x, double y);
+static bool insert(int32_t b);
+static bool build(void);
+static void summarize(void);
+static void walk(uint32_t i, double theta2, double * ax, double * ay);
+static void walk_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+static double opening; //theta^2 of current step
+
+/**
+ * Barnes-Hut gravity: rebuild the quadtree over live bodies and
+ * replace ax/ay of active bodies (all when active is NULL).
+ * theta = 0 gives the exact all-pairs result.
+ * Returns false if out of memory.
+ */
+bool tree_gravity(bodies_t * _bodies, double theta, const uint32_t * active, uint32_t active_s)
+{
+	store = _bodies;
+	targets = active;
+
+	if (active)
+		for (uint32_t k = 0; k != active_s; k++)
+			store->ax[active[k]] = store->ay[active[k]] = 0;
+	else
+	{
+		memset(store->ax, 0, sizeof(double) * store->size);
+		memset(store->ay, 0, sizeof(double) * store->size);
+	}
+
+	if (!pack_bodies(store))
+		return false;
+
+	if (bodies.size < 2)
+		return true;
+
+	if (!build())
+		return false;
+	summarize();
+
+	opening = theta * theta;
+	workers_run(walk_job, NULL, active ? active_s : bodies.size, 256);
+	return true;
+}
+
+/**
+ * Release tree memory
+ */
+void tree_free(void)
+{
+	free(bodies.x);
+	free(bodies.y);
+	free(bodies.m);
+	free(bodies.next);
+	free(bodies.index);
+	free(tree.node);
+	bodies.x = bodies.y = bodies.m = 0;
+	bodies.next = 0;
+	bodies.index = 0;
+	bodies.size = bodies.capacity = 0;
+	tree.node = 0;
+	tree.size = tree.capacity = 0;
+}
+
+static bool pack_bodies(bodies_t * store)
+{
+	if (store->size > bodies.capacity)
+	{
+		double * x = realloc(bodies.x, sizeof(double) * store->size);
+		if (x) bodies.x = x;
+		double * y = realloc(bodies.y, sizeof(double) * store->size);
+		if (y) bodies.y = y;
+		double * m = realloc(bodies.m, sizeof(double) * store->size);
+		if (m) bodies.m = m;
+		int32_t * next = realloc(bodies.next, sizeof(int32_t) * store->size);
+		if (next) bodies.next = next;
+		uint32_t * index = realloc(bodies.index, sizeof(uint32_t) * store->size);
+		if (index) bodies.index = index;
+
+		if (!x || !y || !m || !next || !index) //the old arrays stay
+			return false;
+		bodies.capacity = store->size;
+	}
+
+	bodies.size = 0;
+	for (uint32_t i = 0; i != store->size; i++)
+	{
+		if (!store->alive[i])
+			continue;
+
+		bodies.x[bodies.size] = store->x[i];
+		bodies.y[bodies.size] = store->y[i];
+		bodies.m[bodies.size] = store->m[i];
+		bodies.next[bodies.size] = TREE_NONE;
+		bodies.index[bodies.size] = i;
+		bodies.size++;
+	}
+	return true;
+}
+
+/**
+ * Append node, TREE_NONE if out of memory
+ */
+static int32_t new_node(double cx, double cy, double half, uint8_t depth)
+{
+	if (tree.size == tree.capacity)
+	{
+		const uint32_t capacity = tree.capacity ? tree.capacity * 2 : 1024;
+		node_t * node = realloc(tree.node, sizeof(node_t) * capacity);
+
+		if (!node)
+			return TREE_NONE;
+		tree.node = node;
+		tree.capacity = capacity;
+	}
+
+	node_t * node = &tree.node[tree.size];
+	node->cx = cx;
+	node->cy = cy;
+	node->half = half;
+	node->mass = 0;
+	node->child[0] = node->child[1] = node->child[2] = node->child[3] = TREE_NONE;
+	node->body = TREE_NONE;
+	node->depth = depth;
+
+	return tree.size++;
+}
+
+static uint8_t quadrant(const node_t * node, double x, double y)
+{
+	return (x >= node->cx ? 1 : 0) | (y >= node->cy ? 2 : 0);
+}
+
+/**
+ * Put body into the tree starting from the root, splitting leafs on the way.
+ * Returns false if out of memory.
+ */
+static bool insert(int32_t b)
+{
+	int32_t n = 0;
+
+	while (1)
+	{
+		node_t * node = &tree.node[n];
+		bool leaf = node->child[0] == TREE_NONE && node->child[1] == TREE_NONE && \
+			node->child[2] == TREE_NONE && node->child[3] == TREE_NONE;
+
+		if (leaf && node->body == TREE_NONE)
+		{
+			node->body = b; //empty leaf, take it
+			return true;
+		}
+
+		if (leaf && node->depth >= TREE_MAX_DEPTH)
+		{
+			bodies.next[b] = node->body; //(almost) coincident bodies, chain them
+			node->body = b;
+			return true;
+		}
+
+		if (leaf)
+		{
+			//split: push resident body one level down
+			int32_t resident = node->body;
+			uint8_t q = quadrant(node, bodies.x[resident], bodies.y[resident]);
+			double h = node->half / 2;
+			int32_t c = new_node(node->cx + (q & 1 ? h : -h), node->cy + (q & 2 ? h : -h), h, node->depth + 1);
+
+			if (c == TREE_NONE)
+				return false;
+			node = &tree.node[n]; //node array could be moved by new_node
+			node->child[q] = c;
+			node->body = TREE_NONE;
+			tree.node[c].body = resident;
+		}
+
+		uint8_t q = quadrant(node, bodies.x[b], bodies.y[b]);
+		if (node->child[q] == TREE_NONE)
+		{
+			double h = node->half / 2;
+			int32_t c = new_node(node->cx + (q & 1 ? h : -h), node->cy + (q & 2 ? h : -h), h, node->depth + 1);
+
+			if (c == TREE_NONE)
+				return false;
+			tree.node[n].child[q] = c;
+		}
+		n = tree.node[n].child[q];
+	}
+}
+
+static bool build(void)
+{
+	double x_min = bodies.x[0], x_max = bodies.x[0];
+	double y_min = bodies.y[0], y_max = bodies.y[0];
+
+	for (uint32_t b = 1; b != bodies.size; b++)
+	{
+		if (bodies.x[b] < x_min) x_min = bodies.x[b];
+		if (bodies.x[b] > x_max) x_max = bodies.x[b];
+		if (bodies.y[b] < y_min) y_min = bodies.y[b];
+		if (bodies.y[b] > y_max) y_max = bodies.y[b];
+	}
+
+	double half = fmax(x_max - x_min, y_max - y_min) / 2 * 1.0001 + 1e-9;
+
+	tree.size = 0;
+	if (new_node((x_min + x_max) / 2, (y_min + y_max) / 2, half, 0) == TREE_NONE)
+		return false;
+
+	for (uint32_t b = 0; b != bodies.size; b++)
+		if (!insert(b))
+			return false;
+	return true;
+}
+
+/**
+ * Mass and center of mass for each node. Children are always created
+ * after their parent, so a reverse pass sees children first.
+ */
+static void summarize(void)
+{
+	for (int32_t n = tree.size - 1; n >= 0; n--)
+	{
+		node_t * node = &tree.node[n];
+		double mass = 0, mx = 0, my = 0;
+
+		for (int32_t b = node->body; b != TREE_NONE; b = bodies.next[b])
+		{
+			mass += bodies.m[b];
+			mx += bodies.x[b] * bodies.m[b];
+			my += bodies.y[b] * bodies.m[b];
+		}
+
+		for (uint8_t q = 0; q != 4; q++)
+		{
+			if (node->child[q] == TREE_NONE)
+				continue;
+			const node_t * child = &tree.node[node->child[q]];
+			mass += child->mass;
+			mx += child->mx * child->mass;
+			my += child->my * child->mass;
+		}
+
+		node->mass = mass;
+		node->mx = mass ? mx / mass : node->cx;
+		node->my = mass ? my / mass : node->cy;
+	}
+}
+
+/**
+ * Walk the tree for body i of the store. A cell is used as a single point
+ * mass when (size / distance)^2 < theta^2 and the body is outside of it.
+ */
+static void walk(uint32_t i, double theta2, double * ax, double * ay)
+{
+	const double x = store->x[i], y = store->y[i];
+	int32_t stack[TREE_STACK];
+	uint32_t top = 0;
+
+	stack[top++] = 0;
+
+	while (top)
+	{
+		const node_t * node = &tree.node[stack[--top]];
+
+		if (node->mass == 0)
+			continue;
+
+		double dx = x - node->mx;
+		double dy = y - node->my;
+		double r2 = dx * dx + dy * dy;
+		double size = 2 * node->half;
+		bool inside = fabs(x - node->cx) <= node->half && fabs(y - node->cy) <= node->half;
+
+		if (!inside && size * size < theta2 * r2)
+		{
+			//far enough, whole cell acts as one body
+			double a = -G * node->mass / r2;
+			double r = sqrt(r2);
+			*ax += a * dx / r;
+			*ay += a * dy / r;
+			continue;
+		}
+
+		for (int32_t o = node->body; o != TREE_NONE; o = bodies.next[o])
+		{
+			if (bodies.index[o] == i) continue; //body cannot be compared to himself
+
+			dx = x - bodies.x[o];
+			dy = y - bodies.y[o];
+			r2 = dx * dx + dy * dy;
+			if (r2 == 0) continue; //coincident bodies, merged by impact processing
+
+			double a = -G * bodies.m[o] / r2;
+			double r = sqrt(r2);
+			*ax += a * dx / r;
+			*ay += a * dy / r;
+		}
+
+		for (uint8_t q = 0; q != 4; q++)
+			if (node->child[q] != TREE_NONE)
+				stack[top++] = node->child[q];
+	}
+}
+
+static void walk_job(void * ctx, uint32_t begin, uint32_t end, uint8_t worker)
+{
+	for (uint32_t b = begin; b != end; b++)
+	{
+		uint32_t i = targets ? targets[b] : bodies.index[b];
+		walk(i, opening, &store->ax[i], &store->ay[i]);
+	}
+}
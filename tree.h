@@ -0,0 +1,10 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdint.h>
+#include "space.h"
+
+bool tree_gravity(bodies_t * bodies, double theta, const uint32_t * active, uint32_t active_s);
+void tree_free(void);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "workers.h"
+
+/*
+ * Persistent pool, the calling thread is worker 0. Threads meet on the
+ * start barrier, run their part and meet again on the end barrier, so
+ * workers_run() returns when the whole stage is done. Callers on
+ * different threads (simulation and renderer) take turns on the lock.
+ */
+static struct
+{
+	uint8_t count;
+	pthread_t thread[WORKERS_MAX];
+	pthread_barrier_t start, end;
+	pthread_mutex_t lock; //one job at a time
+	pthread_mutex_t launch; //held while threads are started
+	bool aborted; //a thread did not start, the others leave at once
+	bool quit;
+
+	//current job
+	worker_job_t job;
+	void * ctx;
+	uint32_t size, chunk;
+	uint32_t next; //next chunk to grab, dynamic partitioning
+}pool = { .count = 1, .lock = PTHREAD_MUTEX_INITIALIZER, .launch = PTHREAD_MUTEX_INITIALIZER };
+
+/* Functions */
+static void * worker_thread(void * arg);
+static void worker_do(uint8_t worker);
+
+/**
+ * Start count - 1 threads, 0 = one per CPU. If a thread cannot be
+ * started the ones already running are joined, one worker is left and
+ * false is returned.
+ */
+bool workers_init(uint8_t count)
+{
+	if (pool.count > 1)
+		workers_deinit();
+
+	if (count == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		count = cpus < 1 ? 1 : cpus > WORKERS_MAX ? WORKERS_MAX : cpus;
+	}
+	if (count > WORKERS_MAX)
+		count = WORKERS_MAX;
+
+	pool.count = count;
+	pool.quit = false;
+
+	if (count == 1)
+		return true;
+
+	pthread_barrier_init(&pool.start, NULL, count);
+	pthread_barrier_init(&pool.end, NULL, count);
+
+	//threads wait for the launch, a missing one would block the barriers
+	uintptr_t started = 1;
+
+	pthread_mutex_lock(&pool.launch);
+	while (started != count && !pthread_create(&pool.thread[started], NULL, worker_thread, (void *)started))
+		started++;
+	pool.aborted = started != count;
+	pthread_mutex_unlock(&pool.launch);
+
+	if (!pool.aborted)
+		return true;
+
+	for (uintptr_t i = 1; i != started; i++)
+		pthread_join(pool.thread[i], NULL);
+
+	pthread_barrier_destroy(&pool.start);
+	pthread_barrier_destroy(&pool.end);
+	pool.count = 1;
+	pool.aborted = false;
+	return false;
+}
+
+/**
+ * Run job over [0, size) on all workers and wait for it.
+ * chunk = 0: static split, one contiguous range per worker.
+ * chunk > 0: workers grab ranges of chunk items until nothing is left.
+ * Which worker gets which range is not fixed, so jobs must only write
+ * to their own items (or per worker storage) to stay deterministic.
+ */
+void workers_run(worker_job_t job, void * ctx, uint32_t size, uint32_t chunk)
+{
+	if (size == 0)
+		return;
+
+	if (pool.count == 1)
+	{
+		job(ctx, 0, size, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.job = job;
+	pool.ctx = ctx;
+	pool.size = size;
+	pool.chunk = chunk;
+	__atomic_store_n(&pool.next, 0, __ATOMIC_RELAXED);
+
+	pthread_barrier_wait(&pool.start);
+	worker_do(0);
+	pthread_barrier_wait(&pool.end);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+uint8_t workers_count(void)
+{
+	return pool.count;
+}
+
+/**
+ * Stop and join worker threads
+ */
+void workers_deinit(void)
+{
+	if (pool.count > 1)
+	{
+		pool.quit = true;
+		pthread_barrier_wait(&pool.start);
+
+		for (uint8_t i = 1; i != pool.count; i++)
+			pthread_join(pool.thread[i], NULL);
+
+		pthread_barrier_destroy(&pool.start);
+		pthread_barrier_destroy(&pool.end);
+	}
+
+	pool.count = 1;
+}
+
+static void * worker_thread(void * arg)
+{
+	uint8_t worker = (uintptr_t)arg;
+
+	pthread_mutex_lock(&pool.launch);
+	const bool aborted = pool.aborted;
+	pthread_mutex_unlock(&pool.launch);
+
+	while (!aborted)
+	{
+		pthread_barrier_wait(&pool.start);
+
+		if (pool.quit)
+			break;
+
+		worker_do(worker);
+		pthread_barrier_wait(&pool.end);
+	}
+
+	return NULL;
+}
+
+static void worker_do(uint8_t worker)
+{
+	if (pool.chunk == 0)
+	{
+		uint32_t begin = (uint64_t)pool.size * worker / pool.count;
+		uint32_t end = (uint64_t)pool.size * (worker + 1) / pool.count;
+
+		if (begin != end)
+			pool.job(pool.ctx, begin, end, worker);
+		return;
+	}
+
+	while (1)
+	{
+		uint32_t begin = __atomic_fetch_add(&pool.next, pool.chunk, __ATOMIC_RELAXED);
+
+		if (begin >= pool.size)
+			break;
+
+		uint32_t end = begin + pool.chunk < pool.size ? begin + pool.chunk : pool.size;
+		pool.job(pool.ctx, begin, end, worker);
+	}
+}
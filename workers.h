@@ -0,0 +1,17 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WORKERS_MAX		64
+
+/* Job for items [begin, end), worker is 0..workers_count() - 1 */
+typedef void (*worker_job_t)(void * ctx, uint32_t begin, uint32_t end, uint8_t worker);
+
+bool workers_init(uint8_t count);
+void workers_run(worker_job_t job, void * ctx, uint32_t size, uint32_t chunk);
+uint8_t workers_count(void);
+void workers_deinit(void);
+
+#endif